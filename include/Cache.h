@@ -0,0 +1,70 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * SHA-256 digest used to look up compressed frames
+ *
+ * A cryptographic hash, so two frames can not be made to share a key on
+ * purpose and a hit never returns another frame's data.
+ */
+typedef struct {
+    unsigned char digest[32];
+} CacheKey;
+
+/**
+ * State for hashing data that arrives in pieces (e.g. one row at a time)
+ */
+typedef struct {
+    uint32_t state[8];
+    unsigned char tail[64]; //bytes not hashed yet
+    size_t tailSize;
+    uint64_t length;        //total bytes hashed
+} CacheHasher;
+
+extern void cache_hashInit(CacheHasher *hasher);
+
+/**
+ * Adds bytes to the hash
+ *
+ * @param hasher state to update
+ * @param data bytes to add
+ * @param size number of bytes
+ */
+extern void cache_hashUpdate(CacheHasher *hasher, const void *data, size_t size);
+
+/**
+ * @return the hash of all of the bytes added since cache_hashInit
+ */
+extern CacheKey cache_hashFinal(CacheHasher *hasher);
+
+/**
+ * @return 1 if the process wide cache is turned on
+ */
+extern int cache_enabled(void);
+
+/**
+ * Finds compressed data in the cache and copies it out
+ *
+ * Counts a hit or a miss and marks the entry as recently used.
+ *
+ * @param key hash of the frame and the settings it was compressed with
+ * @param data returns a new copy of the data, which the caller frees
+ * @param size returns the number of bytes in data
+ * @return 1 if the key was found, 0 otherwise
+ */
+extern int cache_lookup(const CacheKey *key, unsigned char **data, size_t *size);
+
+/**
+ * Stores a copy of compressed data, evicting the least recently used entries
+ * to stay under the size limit
+ *
+ * @param key hash of the frame and the settings it was compressed with
+ * @param data bytes to store
+ * @param size number of bytes in data
+ */
+extern void cache_insert(const CacheKey *key, const unsigned char *data, const size_t size);
+
+#endif
@@ -7,7 +7,7 @@
 typedef struct NodeT {
     uint8_t val;
     uint16_t index;
-    uint8_t numChildren;
+    uint16_t numChildren;
     struct NodeT *children;
 } Node;
 
@@ -21,7 +21,8 @@ typedef struct {
  * Initializes the tree with the first tier alphabet
  *
  * @param head a node to make the head of the tree
- * @param alphabetSize the size of the alphabet to use
+ * @param alphabetSize the largest value in the alphabet, values 0 through
+ * alphabetSize are added
  */
 extern void tree_init(Node *head, uint8_t alphabetSize);
 extern void dict_init(Dictionary *dict, uint8_t alphabetSize);
@@ -1,9 +1,65 @@
 #ifndef GIF_H
 #define GIF_H
 
+#include <stddef.h>
+
 struct Gif_priv;
 typedef struct Gif_priv Gif;
 
+struct GifDecoder_priv;
+typedef struct GifDecoder_priv GifDecoder;
+
+/**
+ * What the decoder does with a frame's area before drawing the next frame
+ * (the disposal method in the graphic control extension)
+ */
+typedef enum {
+    GIF_DISPOSE_NONE       = 0, //unspecified, treated like GIF_DISPOSE_KEEP
+    GIF_DISPOSE_KEEP       = 1, //leave the frame on the canvas
+    GIF_DISPOSE_BACKGROUND = 2, //clear the frame's area to transparent
+    GIF_DISPOSE_PREVIOUS   = 3  //restore the area to what it was before
+} GIF_Disposal;
+
+/**
+ * When the encoder empties its LZW dictionary
+ */
+typedef enum {
+    GIF_CLEAR_WHEN_FULL = 0, //start a new dictionary each time it fills up
+    GIF_CLEAR_NEVER     = 1, //keep using the full dictionary to the end
+    GIF_CLEAR_BEST      = 2  //compress both ways and keep the smaller one
+} GIF_ClearStrategy;
+
+/**
+ * Receives the bytes of a gif as they are made
+ *
+ * @param data bytes to write
+ * @param size number of bytes
+ * @param user the pointer given to GIF_SetSink
+ * @return the number of bytes written, less than size is an error
+ */
+typedef size_t (*GIF_WriteFunc)(const void *data, size_t size, void *user);
+
+/**
+ * Called when the library is done with a frame passed to GIF_QueueImage
+ *
+ * @param data the frame that was queued
+ * @param user the pointer passed with it
+ */
+typedef void (*GIF_ReleaseFunc)(const unsigned char *data, void *user);
+
+/**
+ * Information about the last frame returned by GIF_DecodeFrame
+ */
+typedef struct {
+    unsigned short x;          //position of the frame on the canvas
+    unsigned short y;
+    unsigned short width;      //size of the frame's sub-rectangle
+    unsigned short height;
+    unsigned short delayTime;  //hundredths of a second
+    GIF_Disposal disposal;
+    int transparentIndex;      //-1 if the frame has no transparency
+} GIF_FrameInfo;
+
 /**
  * Initializes the header data for a gif file
  *
@@ -11,13 +67,130 @@ typedef struct Gif_priv Gif;
  * @param width width of the image
  * @param height height of the image
  * @param colorTable colors to use
- * @param numColors number of colors in the table (must be power of 2)
+ * @param numColors number of colors in the table (must be power of 2, at most
+ * 256)
  * @param numRepeats number of times to loop the animation
  */
 extern Gif *GIF_Init(const unsigned short width, const unsigned short height,
-                     const unsigned char *colorTable, const unsigned char numColors,
+                     const unsigned char *colorTable, const unsigned short numColors,
                      const unsigned short numRepeats);
 
+/**
+ * Sets how many times the animation loops, replacing the count from GIF_Init
+ *
+ * @param gif gif to change
+ * @param numRepeats number of times to loop, 0 loops forever and -1 plays the
+ * animation once (no looping extension is written)
+ */
+extern void GIF_SetRepeat(Gif *gif, const int numRepeats);
+
+/**
+ * Compresses large frames on several threads
+ *
+ * Frames big enough to give every thread a large piece are cut into pixel
+ * ranges which are compressed in parallel, each starting with a fresh
+ * dictionary, and joined with clear codes. The result is a standard gif that
+ * is slightly bigger than a single threaded encode. If not every thread can
+ * be started the ones that were are used, and with none frames are
+ * compressed on the calling thread.
+ *
+ * @param gif gif to set the thread count for
+ * @param numThreads number of threads to use, 1 compresses on the calling
+ * thread
+ */
+extern void GIF_SetThreads(Gif *gif, const unsigned int numThreads);
+
+/**
+ * Chooses when the LZW dictionary is cleared in images added from now on
+ *
+ * Clearing helps when the colors change part way through a frame, keeping
+ * the full dictionary helps when they do not. GIF_CLEAR_BEST tries both for
+ * each piece of a frame, which takes twice as long.
+ *
+ * @param gif gif to change
+ * @param strategy when to clear, GIF_CLEAR_WHEN_FULL by default
+ */
+extern void GIF_SetClearStrategy(Gif *gif, const GIF_ClearStrategy strategy);
+
+/**
+ * Sets the disposal method and transparent color of images added from now on
+ *
+ * @param gif gif to change
+ * @param disposal what the decoder does with each image's area before drawing
+ * the next one, GIF_DISPOSE_NONE by default
+ * @param transparentIndex color index of pixels that leave the canvas
+ * unchanged, -1 (the default) for none
+ */
+extern void GIF_SetFrameControl(Gif *gif, const GIF_Disposal disposal,
+                                const int transparentIndex);
+
+/**
+ * Lets images added from now on change colors slightly to compress better
+ *
+ * When the LZW dictionary has no string for the pixels so far plus the next
+ * one, a string that continues with a color within the threshold of the
+ * pixel's is used instead, so matches get longer. Of the allowed colors the
+ * one closest to the pixel plus the error of the pixels before it is picked,
+ * so the changes average out. Transparent pixels are never replaced or used
+ * as replacements. The result is an ordinary gif, mostly smaller for noisy or
+ * dithered images.
+ *
+ * @param gif gif to change
+ * @param threshold largest distance between the RGB colors (0 to 441) of a
+ * pixel and its replacement, 0 (the default) keeps every pixel exact
+ */
+extern void GIF_SetLossy(Gif *gif, const unsigned int threshold);
+
+/**
+ * Keeps the gif under a size limit
+ *
+ * The bytes left are shared evenly over the frames left. A frame over its
+ * share is compressed again with a higher lossy threshold, which later frames
+ * keep; frames well under it lower the threshold again. When even the highest
+ * threshold is not enough, an image covering the whole canvas that fits on
+ * its own replaces the one before it, which is dropped, and its delay is
+ * added to theirs. Frames with no room left are dropped and their delay goes
+ * to the frame before, so the animation keeps its length. Overrides
+ * GIF_SetLossy while set. Images added with GIF_BeginFrame count as frames of
+ * the budget and their bytes are counted, but they are never compressed
+ * again or dropped. The first frame is always kept, so a limit smaller than
+ * it can't be met; GIF_Finish then fails.
+ *
+ * @param gif gif to change
+ * @param maxBytes size of the whole file, 0 (the default) for no limit
+ * @param expectedFrames number of frames that will be added, used to share
+ * the bytes out; with too few, the last frames may be dropped
+ */
+extern void GIF_SetBudget(Gif *gif, const size_t maxBytes, const size_t expectedFrames);
+
+/**
+ * @return the size the gif is expected to end at under its budget, from the
+ * frames added so far, 0 if it has no budget
+ */
+extern size_t GIF_PredictSize(const Gif *gif);
+
+/**
+ * Turns on the process wide cache of compressed frames
+ *
+ * Frames are looked up by a SHA-256 hash of their pixels, size and the
+ * settings they are compressed with, so a frame that any gif already
+ * compressed is copied instead of compressed again. The least recently used
+ * frames are dropped to stay under the size limit. The cache can be used from
+ * several threads at once.
+ *
+ * @param size maximum number of bytes to keep, 0 turns the cache off and
+ * empties it
+ */
+extern void GIF_SetCacheSize(const size_t size);
+
+/**
+ * Gets the number of frames found and not found in the cache
+ *
+ * @param hits returns the number of frames copied from the cache
+ * @param misses returns the number of frames compressed while the cache was on
+ */
+extern void GIF_GetCacheStats(unsigned long *hits, unsigned long *misses);
+
 /**
  * Adds an image to the gif animation
  *
@@ -28,17 +201,242 @@ extern Gif *GIF_Init(const unsigned short width, const unsigned short height,
  */
 extern void GIF_AddImage(Gif *gif, const unsigned char *data, const unsigned short delayTime);
 
+/**
+ * Adds an image that is compressed on the gif's threads while the caller
+ * prepares the next one
+ *
+ * The data is not copied, it must stay unchanged until release is called.
+ * Images are stored in the order they were queued. Release is called on the
+ * caller's thread from a later GIF_ call, this one if there are no threads.
+ * Queueing waits when every thread already has two images. GIF_FlushQueue
+ * waits for all of them.
+ *
+ * @param gif gif to add the image to
+ * @param data array of gif->width*gif->height color codes
+ * @param delayTime ammount of time to show this frame in hundredths of a second
+ * @param release called with data and user once the image is stored, or NULL
+ * @param user passed to release
+ */
+extern void GIF_QueueImage(Gif *gif, const unsigned char *data, const unsigned short delayTime,
+                           GIF_ReleaseFunc release, void *user);
+
+/**
+ * Stores every image queued with GIF_QueueImage and calls their release
+ * functions, after which the library no longer reads any queued data
+ *
+ * @param gif gif to wait for
+ */
+extern void GIF_FlushQueue(Gif *gif);
+
+/**
+ * Adds part of a larger frame buffer to the gif animation without copying it
+ *
+ * Rows are read directly from the buffer. The rectangle x, y, width, height
+ * is both the part of the buffer that is read and where the image is placed
+ * on the gif's canvas, the rest of the canvas keeps the previous frame.
+ * The rectangle is clipped to the gif's size.
+ *
+ * @param gif gif to add the image to
+ * @param base color code of the top-left pixel of the frame buffer, which
+ * covers the whole gif
+ * @param stride number of bytes from the start of one row to the next
+ * @param x column of the rectangle's left edge
+ * @param y row of the rectangle's top edge
+ * @param width width of the rectangle
+ * @param height height of the rectangle
+ * @param delayTime ammount of time to show this frame in hundredths of a second
+ */
+extern void GIF_AddImageStrided(Gif *gif, const unsigned char *base, const size_t stride,
+                                unsigned short x, unsigned short y,
+                                unsigned short width, unsigned short height,
+                                const unsigned short delayTime);
+
+/**
+ * Adds a two color frame stored with one bit per pixel
+ *
+ * Bit x % 8 (least significant first) of byte x / 8 of a row is the pixel in
+ * column x. The bits are converted to color indices as they are compressed so
+ * only the bitmap is read. Like GIF_AddImageStrided the rectangle x, y,
+ * width, height is both the part of the bitmap that is read and where the
+ * image is placed, and is clipped to the gif's size.
+ *
+ * @param gif gif to add the image to
+ * @param bits bitmap covering the whole gif
+ * @param stride number of bytes from the start of one row to the next
+ * @param colors color index of 0 bits and of 1 bits
+ * @param x column of the rectangle's left edge
+ * @param y row of the rectangle's top edge
+ * @param width width of the rectangle
+ * @param height height of the rectangle
+ * @param delayTime ammount of time to show this frame in hundredths of a second
+ */
+extern void GIF_AddBitmap(Gif *gif, const unsigned char *bits, const size_t stride,
+                          const unsigned char colors[2],
+                          unsigned short x, unsigned short y,
+                          unsigned short width, unsigned short height,
+                          const unsigned short delayTime);
+
+/**
+ * Starts an image whose rows are added with GIF_AddRows
+ *
+ * Only the compression state and a few rows of compressed data are kept in
+ * memory, so frames can be far bigger than the memory they would fill. With a
+ * sink the data goes to it one sub-block at a time. The frame's code size
+ * covers the whole color table because its pixels are not known up front,
+ * GIF_CLEAR_BEST is treated as GIF_CLEAR_WHEN_FULL and the cache and threads
+ * are not used. An image that was started and not ended is ended first.
+ *
+ * @param gif gif to add the image to
+ * @param x column of the image's left edge
+ * @param y row of the image's top edge
+ * @param width width of the image
+ * @param height height of the image
+ * @param delayTime ammount of time to show this frame in hundredths of a second
+ */
+extern void GIF_BeginFrame(Gif *gif, unsigned short x, unsigned short y,
+                           unsigned short width, unsigned short height,
+                           const unsigned short delayTime);
+
+/**
+ * Compresses the next rows of the image started by GIF_BeginFrame
+ *
+ * @param gif gif with a started image
+ * @param rows color codes of the first row, width bytes per row
+ * @param stride number of bytes from the start of one row to the next
+ * @param numRows number of rows, rows past the image's height are ignored
+ */
+extern void GIF_AddRows(Gif *gif, const unsigned char *rows, const size_t stride,
+                        const size_t numRows);
+
+/**
+ * Finishes the image started by GIF_BeginFrame, rows that were not added are
+ * color 0
+ */
+extern void GIF_EndFrame(Gif *gif);
+
+/**
+ * Sends the file to a function as it is made instead of keeping it for
+ * GIF_Write
+ *
+ * Must be called before the first image is added. The header is written with
+ * the first image, so the repeat count can't be changed after that. Each
+ * image is written as soon as it is compressed and then freed.
+ *
+ * @param gif gif to send
+ * @param sink function to write with
+ * @param user passed to the function
+ */
+extern void GIF_SetSink(Gif *gif, GIF_WriteFunc sink, void *user);
+
+/**
+ * Ends the current image and writes the trailer to the sink
+ *
+ * @param gif gif with a sink
+ * @return 1 if every write succeeded, 0 if one failed, there is no sink or
+ * the gif is bigger than its GIF_SetBudget limit
+ */
+extern int GIF_Finish(Gif *gif);
+
+/**
+ * @return the number of frames stored so far, leaving out frames that are
+ * still queued or held back and frames dropped or merged to fit the budget
+ */
+extern size_t GIF_NumFrames(const Gif *gif);
+
 /**
  * Writes a gif to a file
  *
+ * Only for gifs without a sink.
+ *
  * @param gif data to write
  * @param fileName file to write to
  */
-extern void GIF_Write(const Gif *gif, const char *fileName);
+extern void GIF_Write(Gif *gif, const char *fileName);
 
 /**
  * Deallocates gif data
  */
 extern void GIF_Free(Gif *gif);
 
+/**
+ * Opens a gif held in memory for decoding
+ *
+ * The data is not copied and must stay valid until GIF_DecoderFree. All of the
+ * memory the decoder needs is allocated here (except a backup area allocated
+ * the first time a frame uses GIF_DISPOSE_PREVIOUS) so decoding frames does
+ * not allocate.
+ *
+ * @param data the contents of a gif file
+ * @param size number of bytes in data
+ * @return the decoder or NULL if the data does not have a valid gif header
+ */
+extern GifDecoder *GIF_DecoderOpen(const unsigned char *data, const size_t size);
+
+/**
+ * @return the width of the decoded canvas in pixels
+ */
+extern unsigned short GIF_DecoderWidth(const GifDecoder *dec);
+
+/**
+ * @return the height of the decoded canvas in pixels
+ */
+extern unsigned short GIF_DecoderHeight(const GifDecoder *dec);
+
+/**
+ * @return the number of times the animation loops, 0 if it loops forever or
+ * -1 if it has no looping extension and plays once
+ */
+extern int GIF_DecoderRepeat(const GifDecoder *dec);
+
+/**
+ * Decodes the next frame and composites it onto an RGBA canvas
+ *
+ * The canvas holds the result of all of the previous frames so the same
+ * canvas must be passed for every frame. It is cleared to transparent when
+ * the first frame is decoded. The disposal of the previous frame is applied
+ * before the new frame is drawn.
+ *
+ * @param dec decoder to read from
+ * @param canvas width*height*4 bytes, 4 bytes (R, G, B, A) per pixel
+ * @param info if not NULL receives information about the decoded frame
+ * @return 1 if a frame was decoded, 0 at the end of the file, -1 if the data
+ * is corrupt
+ */
+extern int GIF_DecodeFrame(GifDecoder *dec, unsigned char *canvas, GIF_FrameInfo *info);
+
+/**
+ * Decodes one frame of the animation as a smaller RGBA image
+ *
+ * Each thumbnail pixel is the average of the box of canvas pixels it covers,
+ * with alpha for the part of the box that is not transparent. Frames before
+ * the last one that covers the whole canvas without transparency are skipped
+ * without decompressing them. If no earlier frame shows through, rows are
+ * added to the thumbnail as they are decoded without a full size canvas;
+ * otherwise a canvas is allocated for the frames that are drawn.
+ *
+ * GIF_DecodeFrame starts again from the first frame afterwards.
+ *
+ * @param dec decoder to read from
+ * @param frameIndex frame to decode, 0 for the first
+ * @param pixels width*height*4 bytes, 4 bytes (R, G, B, A) per pixel
+ * @param width thumbnail width, from 1 to the canvas width
+ * @param height thumbnail height, from 1 to the canvas height
+ * @param info if not NULL receives information about the decoded frame
+ * @return 1 if the frame was decoded, 0 if the gif has fewer frames, -1 if the
+ * data is corrupt or the size is not allowed
+ */
+extern int GIF_DecodeThumbnail(GifDecoder *dec, const size_t frameIndex, unsigned char *pixels,
+                               const unsigned short width, const unsigned short height,
+                               GIF_FrameInfo *info);
+
+/**
+ * Restarts decoding at the first frame
+ */
+extern void GIF_DecoderRewind(GifDecoder *dec);
+
+/**
+ * Deallocates the decoder, does not free the data it was opened with
+ */
+extern void GIF_DecoderFree(GifDecoder *dec);
+
 #endif
@@ -0,0 +1,140 @@
+#ifndef HASHLIFE_H
+#define HASHLIFE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * A square of 2^level cells on each side, stored as a quadtree
+ *
+ * Nodes are canonical: two nodes with the same contents are the same pointer,
+ * so the future of a node only has to be computed once.
+ */
+typedef struct LifeNodeT {
+    struct LifeNodeT *nw, *ne, *sw, *se; //quadrants, NULL for single cells
+    struct LifeNodeT *result;  //the center of this node some steps later
+    struct LifeNodeT *next;    //next node in the same hash bucket
+    uint64_t population;       //number of live cells
+    uint8_t level;
+    uint8_t marked;            //used while collecting garbage
+} LifeNode;
+
+typedef struct {
+    LifeNode *root;
+    int64_t x;              //position of the root's top-left cell
+    int64_t y;
+    uint64_t generation;
+    int stepLog2;           //life_step advances 2^stepLog2 generations
+
+    LifeNode **buckets;     //hash table of every node
+    size_t numBuckets;
+    size_t numNodes;
+    size_t maxNodes;        //collect garbage when there are more nodes
+
+    LifeNode dead;          //the two single cell nodes
+    LifeNode alive;
+    LifeNode *empty[64];    //the empty node of each level, once created
+} Life;
+
+/**
+ * Initializes an empty universe
+ *
+ * @param life universe to initialize
+ */
+extern void life_init(Life *life);
+
+/**
+ * Deallocates every node of the universe
+ */
+extern void life_free(Life *life);
+
+/**
+ * Sets the state of one cell, growing the universe if necessary
+ *
+ * @param life universe to change
+ * @param x column of the cell
+ * @param y row of the cell
+ * @param alive 1 to make the cell alive, 0 to kill it
+ */
+extern void life_set(Life *life, int64_t x, int64_t y, const int alive);
+
+/**
+ * @return 1 if the cell at x, y is alive, 0 otherwise
+ */
+extern int life_get(const Life *life, int64_t x, int64_t y);
+
+/**
+ * Adds a pattern in run length encoded format (as used by Golly)
+ *
+ * Lines starting with # and the header line are skipped.
+ *
+ * @param life universe to add the pattern to
+ * @param rle the pattern
+ * @param x column of the pattern's top-left corner
+ * @param y row of the pattern's top-left corner
+ * @return 1 on success, 0 if the pattern could not be parsed
+ */
+extern int life_loadRLE(Life *life, const char *rle, int64_t x, int64_t y);
+
+/**
+ * Sets how many generations life_step advances
+ *
+ * @param life universe to change
+ * @param stepLog2 step size is 2^stepLog2 generations
+ */
+extern void life_setStep(Life *life, const int stepLog2);
+
+/**
+ * Advances the universe by 2^stepLog2 generations
+ */
+extern void life_step(Life *life);
+
+/**
+ * @return the number of live cells
+ */
+extern uint64_t life_population(const Life *life);
+
+/**
+ * Draws part of the universe into an indexed frame
+ *
+ * With a positive zoom each cell is drawn as a square of 2^zoom pixels, with
+ * a negative zoom each pixel shows 2^-zoom cells on each side and is alive if
+ * any of them are. Only the nodes that are visible and not empty are visited.
+ *
+ * @param life universe to draw
+ * @param frame width*height color indices to draw into
+ * @param width width of the frame in pixels
+ * @param height height of the frame in pixels
+ * @param x column of the cell at the top-left of the frame
+ * @param y row of the cell at the top-left of the frame
+ * @param zoom log2 of the pixels per cell
+ * @param dead color index of dead cells
+ * @param alive color index of live cells
+ */
+extern void life_render(const Life *life, unsigned char *frame,
+                        const size_t width, const size_t height,
+                        const int64_t x, const int64_t y, const int zoom,
+                        const unsigned char dead, const unsigned char alive);
+
+/**
+ * Draws part of the universe into a bitmap with one bit per pixel
+ *
+ * Like life_render, but live pixels are 1 bits and dead pixels 0 bits. Bit
+ * x % 8 (least significant first) of byte x / 8 of a row is the pixel in
+ * column x.
+ *
+ * @param life universe to draw
+ * @param bits stride*height bytes to draw into
+ * @param stride bytes from the start of one row to the next, at least
+ * (width + 7) / 8
+ * @param width width of the bitmap in pixels
+ * @param height height of the bitmap in pixels
+ * @param x column of the cell at the top-left of the bitmap
+ * @param y row of the cell at the top-left of the bitmap
+ * @param zoom log2 of the pixels per cell
+ */
+extern void life_renderBitmap(const Life *life, unsigned char *bits, const size_t stride,
+                              const size_t width, const size_t height,
+                              const int64_t x, const int64_t y, const int zoom);
+
+#endif
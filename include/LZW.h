@@ -8,6 +8,60 @@
 //the maximum index for gifs
 #define MAX_INDEX 0xFFF
 
+//no code, used for empty slots in the encoder and decoder tables
+#define LZW_NO_CODE 0xFFFF
+
+/**
+ * State for compressing into caller owned buffers
+ *
+ * The dictionary is stored in fixed size tables inside the state so
+ * compressing never allocates.
+ */
+typedef struct {
+    uint16_t firstChild[MAX_INDEX + 1];  //first longer string, 0 for none
+    uint16_t nextSibling[MAX_INDEX + 1]; //next string with the same prefix
+    uint8_t value[MAX_INDEX + 1];        //last byte of each string
+    uint16_t prefix;       //code of the string being matched, or LZW_NO_CODE
+    uint16_t nextCode;     //code the next new string gets
+    uint8_t alphabetSize;
+    uint8_t started;       //0 until the first clear code is written
+    uint8_t clearWhenFull; //1 to start over when the dictionary fills (the
+                           //default), 0 to keep using the full dictionary
+    const struct LZWLossyTable_priv *lossy; //colors for lossy matching, or NULL
+    int exact;              //byte lossy matching never replaces or uses, or -1
+    int error[3];           //color error carried on to the next byte
+} LZWEncoder;
+
+/**
+ * Which bytes may stand in for each other in lossy compression
+ *
+ * Built once per palette and threshold, then shared by any number of
+ * encoders.
+ */
+typedef struct LZWLossyTable_priv {
+    uint8_t palette[3*256];   //RGB color of each byte
+    uint64_t similar[256][4]; //bit b of similar[a] is set if b may replace a
+    uint8_t hasSimilar[256];  //1 if any byte may replace a
+} LZWLossyTable;
+
+/**
+ * State for decompressing into caller owned buffers
+ *
+ * Each code's string is its prefix code's string plus one suffix byte.
+ */
+typedef struct {
+    uint16_t prefix[MAX_INDEX + 1];
+    uint8_t suffix[MAX_INDEX + 1];
+    uint8_t first[MAX_INDEX + 1];     //first byte of each string
+    uint16_t length[MAX_INDEX + 1];   //length of each string
+    uint16_t nextCode;
+    uint16_t oldCode;       //previous code, or LZW_NO_CODE after a clear
+    uint16_t pendingCode;   //code whose string did not fit in the output
+    uint16_t pendingOffset; //bytes of it already written
+    uint8_t alphabetSize;
+    uint8_t error;          //1 if an invalid code was found
+} LZWDecoder;
+
 typedef struct {
     Dictionary *dict;
     uint8_t *currSym;
@@ -41,6 +95,147 @@ extern void LZW_Compress(const char *string, size_t stringc, uint16_t **code, si
  */
 extern void LZW_Decompress(const uint16_t *code, const size_t codec, char **string, uint8_t alphabetSize);
 
+/**
+ * The most codes LZW_CompressBuf can write for stringc bytes of input
+ *
+ * @param stringc the size of the input
+ * @return the number of codes the output buffer needs room for
+ */
+extern size_t LZW_CompressBound(const size_t stringc);
+
+/**
+ * The most bytes codec codes can decompress to
+ *
+ * @param codec the number of codes
+ * @return the number of bytes the output buffer needs room for
+ */
+extern size_t LZW_DecompressBound(const size_t codec);
+
+/**
+ * Compresses a string into a caller owned buffer
+ *
+ * Does not allocate, the dictionary is kept on the stack.
+ *
+ * @param string the text to compress
+ * @param stringc the size of the text
+ * @param code buffer to write the codes to
+ * @param codec the size of the code buffer, LZW_CompressBound(stringc) is
+ * always enough
+ * @param written returns the number of codes written
+ * @param alphabetSize the number of possible initial codes
+ * @return 1 on success, 0 if the code buffer was too small
+ */
+extern int LZW_CompressBuf(const char *string, const size_t stringc,
+                           uint16_t *code, const size_t codec, size_t *written,
+                           uint8_t alphabetSize);
+
+/**
+ * Decompresses LZW codes into a caller owned buffer
+ *
+ * Does not allocate, the dictionary is kept on the stack.
+ *
+ * @param code the codes to decompress
+ * @param codec the number of codes
+ * @param string buffer to write the text to
+ * @param stringc the size of the text buffer
+ * @param written returns the number of bytes written
+ * @param alphabetSize the number of possible initial codes
+ * @return 1 on success, 0 if the buffer was too small or a code was invalid
+ */
+extern int LZW_DecompressBuf(const uint16_t *code, const size_t codec,
+                             char *string, const size_t stringc, size_t *written,
+                             uint8_t alphabetSize);
+
+/**
+ * Initializes the state for compressing in chunks
+ *
+ * @param enc state to initialize
+ * @param alphabetSize the number of possible initial codes
+ */
+extern void LZW_EncoderInit(LZWEncoder *enc, uint8_t alphabetSize);
+
+/**
+ * Finds the bytes whose colors are close enough to replace each other
+ *
+ * @param table table to fill
+ * @param palette 3 bytes of RGB for each color, bytes past the end are black
+ * @param numColors number of colors in the palette
+ * @param threshold largest RGB distance between a byte and its replacement
+ */
+extern void LZW_LossyTableInit(LZWLossyTable *table, const uint8_t *palette,
+                               const size_t numColors, const unsigned int threshold);
+
+/**
+ * Lets the encoder continue a string with a byte of a similar color
+ *
+ * When the dictionary has no string for the current one plus the next byte,
+ * a string that continues with a byte the table allows in its place is used
+ * instead, the one closest to the byte's color plus the error carried from
+ * the bytes before. Part of each byte's color error is carried on to the next
+ * one so the errors average out. The output is ordinary LZW that decodes to
+ * the substituted bytes.
+ *
+ * @param enc state from LZW_EncoderInit
+ * @param table which bytes may replace each other, kept by reference, NULL
+ * for lossless
+ * @param exact byte that is never replaced or used as a replacement (e.g. a
+ * transparent color), -1 for none
+ */
+extern void LZW_EncoderSetLossy(LZWEncoder *enc, const LZWLossyTable *table, const int exact);
+
+/**
+ * Compresses the next chunk of input
+ *
+ * Stops early if the code buffer fills, call again with the rest of the input
+ * and more room.
+ *
+ * @param enc state from LZW_EncoderInit or a previous chunk
+ * @param string the next part of the text
+ * @param stringc the size of this part
+ * @param code buffer to write the codes to
+ * @param codec the size of the code buffer
+ * @param written returns the number of codes written
+ * @return the number of bytes of input used
+ */
+extern size_t LZW_CompressChunk(LZWEncoder *enc, const char *string, const size_t stringc,
+                                uint16_t *code, const size_t codec, size_t *written);
+
+/**
+ * Writes the code for the end of the input
+ *
+ * @param enc state to finish
+ * @param code buffer with room for the last code
+ * @param codec the size of the code buffer
+ * @return the number of codes written (0 for empty input or no room)
+ */
+extern size_t LZW_CompressFinish(LZWEncoder *enc, uint16_t *code, const size_t codec);
+
+/**
+ * Initializes the state for decompressing in chunks
+ *
+ * @param dec state to initialize
+ * @param alphabetSize the number of possible initial codes
+ */
+extern void LZW_DecoderInit(LZWDecoder *dec, uint8_t alphabetSize);
+
+/**
+ * Decompresses the next chunk of codes
+ *
+ * Stops when the codes are used up, at a stop code, at an invalid code (which
+ * sets dec->error) or when the output is full. A string that does not fit is
+ * finished by the next call, so chunks of codes and output can be any size.
+ *
+ * @param dec state from LZW_DecoderInit or a previous chunk
+ * @param code the next codes
+ * @param codec the number of codes
+ * @param string buffer to write the text to
+ * @param stringc the size of the text buffer
+ * @param consumed returns the number of codes used
+ * @return the number of bytes written
+ */
+extern size_t LZW_DecompressChunk(LZWDecoder *dec, const uint16_t *code, const size_t codec,
+                                  char *string, const size_t stringc, size_t *consumed);
+
 /**
  * Compresses data one byte at a time
  *
@@ -0,0 +1,40 @@
+#ifndef POOL_H
+#define POOL_H
+
+struct Pool_priv;
+typedef struct Pool_priv Pool;
+
+/**
+ * Starts a pool of worker threads
+ *
+ * @param numThreads number of threads to start
+ * @return the pool, or NULL if the threads could not be started
+ */
+extern Pool *pool_init(const unsigned int numThreads);
+
+/**
+ * @return the number of threads the pool started, which can be fewer than
+ * asked for if the system ran out
+ */
+extern unsigned int pool_numThreads(const Pool *pool);
+
+/**
+ * Queues a task to be run on one of the pool's threads
+ *
+ * @param pool pool to run the task on
+ * @param task function to call
+ * @param arg argument passed to the function
+ */
+extern void pool_submit(Pool *pool, void (*task)(void *), void *arg);
+
+/**
+ * Waits until every submitted task has finished
+ */
+extern void pool_wait(Pool *pool);
+
+/**
+ * Finishes the queued tasks, stops the threads and deallocates the pool
+ */
+extern void pool_free(Pool *pool);
+
+#endif
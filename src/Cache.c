@@ -0,0 +1,309 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "Cache.h"
+#include "Gif.h"
+
+typedef struct EntryT {
+    CacheKey key;
+    unsigned char *data;
+    size_t size;
+    struct EntryT *next;  //next entry in the same bucket
+    struct EntryT *newer; //least recently used list
+    struct EntryT *older;
+} Entry;
+
+//the process wide cache, every access holds lock
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static Entry **buckets = NULL;
+static size_t numBuckets = 0;
+static size_t numEntries = 0;
+static Entry *newest = NULL;
+static Entry *oldest = NULL;
+static size_t usedBytes = 0;
+static size_t maxBytes = 0;
+static unsigned long hits = 0;
+static unsigned long misses = 0;
+
+//SHA-256 round constants (FIPS 180-4)
+static const uint32_t ROUND_CONSTANTS[64] = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2};
+
+static uint32_t rotr(uint32_t x, int r) {
+    return (x >> r) | (x << (32 - r));
+}
+
+/**
+ * Hashes one 64 byte block (the SHA-256 compression function)
+ */
+static void hashBlock(CacheHasher *hasher, const unsigned char *block) {
+    uint32_t w[64];
+    int i;
+    for(i = 0; i < 16; i++) { //big endian words
+        w[i] = (uint32_t) block[4*i] << 24 | (uint32_t) block[4*i + 1] << 16 |
+               (uint32_t) block[4*i + 2] << 8 | block[4*i + 3];
+    }
+    for(i = 16; i < 64; i++) {
+        const uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        const uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t v[8];
+    memcpy(v, hasher->state, sizeof(v));
+    for(i = 0; i < 64; i++) {
+        const uint32_t s1 = rotr(v[4], 6) ^ rotr(v[4], 11) ^ rotr(v[4], 25);
+        const uint32_t choice = (v[4] & v[5]) ^ (~v[4] & v[6]);
+        const uint32_t t1 = v[7] + s1 + choice + ROUND_CONSTANTS[i] + w[i];
+        const uint32_t s0 = rotr(v[0], 2) ^ rotr(v[0], 13) ^ rotr(v[0], 22);
+        const uint32_t majority = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+
+        memmove(v + 1, v, 7 * sizeof(uint32_t));
+        v[4] += t1;
+        v[0] = t1 + s0 + majority;
+    }
+
+    for(i = 0; i < 8; i++) {
+        hasher->state[i] += v[i];
+    }
+}
+
+void cache_hashInit(CacheHasher *hasher) {
+    static const uint32_t INITIAL_STATE[8] = {
+        0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+        0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+    memcpy(hasher->state, INITIAL_STATE, sizeof(INITIAL_STATE));
+    hasher->tailSize = 0;
+    hasher->length = 0;
+}
+
+void cache_hashUpdate(CacheHasher *hasher, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    hasher->length += size;
+
+    //finish the block left over from the last update
+    if(hasher->tailSize > 0) {
+        size_t needed = 64 - hasher->tailSize;
+        if(size < needed) {
+            memcpy(hasher->tail + hasher->tailSize, bytes, size);
+            hasher->tailSize += size;
+            return;
+        }
+
+        memcpy(hasher->tail + hasher->tailSize, bytes, needed);
+        hashBlock(hasher, hasher->tail);
+        bytes += needed;
+        size -= needed;
+        hasher->tailSize = 0;
+    }
+
+    for(; size >= 64; bytes += 64, size -= 64) {
+        hashBlock(hasher, bytes);
+    }
+
+    memcpy(hasher->tail, bytes, size);
+    hasher->tailSize = size;
+}
+
+CacheKey cache_hashFinal(CacheHasher *hasher) {
+    //a 1 bit, zeros and the length in bits, big endian, ending a block
+    const uint64_t bits = hasher->length * 8;
+    hasher->tail[hasher->tailSize++] = 0x80;
+    if(hasher->tailSize > 56) {
+        memset(hasher->tail + hasher->tailSize, 0, 64 - hasher->tailSize);
+        hashBlock(hasher, hasher->tail);
+        hasher->tailSize = 0;
+    }
+    memset(hasher->tail + hasher->tailSize, 0, 56 - hasher->tailSize);
+
+    int i;
+    for(i = 0; i < 8; i++) {
+        hasher->tail[56 + i] = bits >> (56 - 8*i);
+    }
+    hashBlock(hasher, hasher->tail);
+
+    CacheKey key;
+    for(i = 0; i < 32; i++) {
+        key.digest[i] = hasher->state[i / 4] >> (24 - 8*(i % 4));
+    }
+
+    return key;
+}
+
+/**
+ * @return the bucket of a key, the digest is already uniformly distributed
+ */
+static size_t bucketOf(const CacheKey *key) {
+    size_t index = 0;
+    int i;
+    for(i = 0; i < (int) sizeof(size_t); i++) {
+        index = (index << 8) | key->digest[i];
+    }
+    return index & (numBuckets - 1);
+}
+
+static Entry **findLink(const CacheKey *key) {
+    Entry **link = &buckets[bucketOf(key)];
+    while(*link != NULL && memcmp((*link)->key.digest, key->digest, sizeof(key->digest)) != 0) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+static void unlinkLRU(Entry *entry) {
+    if(entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    }else{
+        newest = entry->older;
+    }
+
+    if(entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    }else{
+        oldest = entry->newer;
+    }
+}
+
+static void pushNewest(Entry *entry) {
+    entry->older = newest;
+    entry->newer = NULL;
+    if(newest != NULL) {
+        newest->newer = entry;
+    }
+    newest = entry;
+    if(oldest == NULL) {
+        oldest = entry;
+    }
+}
+
+static size_t entryBytes(const Entry *entry) {
+    return sizeof(Entry) + entry->size;
+}
+
+/**
+ * Removes an entry from the cache and frees it
+ */
+static void removeEntry(Entry *entry) {
+    Entry **link = findLink(&entry->key);
+    *link = entry->next;
+    unlinkLRU(entry);
+
+    usedBytes -= entryBytes(entry);
+    numEntries--;
+    free(entry->data);
+    free(entry);
+}
+
+static void growTable(void) {
+    Entry **oldBuckets = buckets;
+    const size_t oldNumBuckets = numBuckets;
+    numBuckets = numBuckets > 0 ? 2 * numBuckets : 256;
+    buckets = calloc(numBuckets, sizeof(Entry *));
+
+    size_t i;
+    for(i = 0; i < oldNumBuckets; i++) {
+        Entry *entry = oldBuckets[i];
+        while(entry != NULL) {
+            Entry *next = entry->next;
+            const size_t bucket = bucketOf(&entry->key);
+            entry->next = buckets[bucket];
+            buckets[bucket] = entry;
+            entry = next;
+        }
+    }
+
+    free(oldBuckets);
+}
+
+int cache_enabled(void) {
+    pthread_mutex_lock(&lock);
+    int enabled = maxBytes > 0;
+    pthread_mutex_unlock(&lock);
+
+    return enabled;
+}
+
+int cache_lookup(const CacheKey *key, unsigned char **data, size_t *size) {
+    int found = 0;
+
+    pthread_mutex_lock(&lock);
+    Entry *entry = numBuckets > 0 ? *findLink(key) : NULL;
+    if(entry != NULL) {
+        unlinkLRU(entry);
+        pushNewest(entry);
+
+        *data = malloc(entry->size);
+        memcpy(*data, entry->data, entry->size);
+        *size = entry->size;
+
+        hits++;
+        found = 1;
+    }else{
+        misses++;
+    }
+    pthread_mutex_unlock(&lock);
+
+    return found;
+}
+
+void cache_insert(const CacheKey *key, const unsigned char *data, const size_t size) {
+    pthread_mutex_lock(&lock);
+    if(sizeof(Entry) + size > maxBytes) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    if(numEntries >= numBuckets) {
+        growTable();
+    }
+
+    //another thread may have compressed the same frame
+    Entry **link = findLink(key);
+    if(*link == NULL) {
+        Entry *entry = malloc(sizeof(Entry));
+        entry->key = *key;
+        entry->data = malloc(size);
+        memcpy(entry->data, data, size);
+        entry->size = size;
+        entry->next = NULL;
+        *link = entry;
+        pushNewest(entry);
+
+        usedBytes += entryBytes(entry);
+        numEntries++;
+
+        while(usedBytes > maxBytes) {
+            removeEntry(oldest);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void GIF_SetCacheSize(const size_t size) {
+    pthread_mutex_lock(&lock);
+    maxBytes = size;
+    while(usedBytes > maxBytes) {
+        removeEntry(oldest);
+    }
+
+    if(maxBytes == 0) {
+        free(buckets);
+        buckets = NULL;
+        numBuckets = 0;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void GIF_GetCacheStats(unsigned long *cacheHits, unsigned long *cacheMisses) {
+    pthread_mutex_lock(&lock);
+    *cacheHits = hits;
+    *cacheMisses = misses;
+    pthread_mutex_unlock(&lock);
+}
@@ -4,11 +4,11 @@
 
 void tree_init(Node *head, uint8_t alphabetSize) {
     head->val = head->index = -1;
-    head->numChildren = alphabetSize;
-    head->children = malloc(sizeof(Node)*alphabetSize);
+    head->numChildren = alphabetSize + 1;
+    head->children = malloc(sizeof(Node)*head->numChildren);
 
     int i;
-    for(i = 0; i < alphabetSize; i++) {
+    for(i = 0; i < head->numChildren; i++) {
         head->children[i].val = head->children[i].index = i;
         head->children[i].numChildren = 0;
     }
@@ -1,9 +1,13 @@
 #include <math.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include "Gif.h"
 #include "LZW.h"
+#include "Pool.h"
+#include "Cache.h"
 
 //Can't have the \0, so I have to initialize as actual char arrays
 static const char SIGNATURE[3] = {'G', 'I', 'F'};
@@ -21,13 +25,49 @@ static const char REPEAT_HEADER[19] = {
     0x03,       //3 bytes of data left
     0x01};      //sub-block index
     //These bytes are written dynamically
-    //REPEAT_TIMES >> 8, REPEAT_TIMES & 0xFF, //number of repeats
+    //REPEAT_TIMES & 0xFF, REPEAT_TIMES >> 8, //number of repeats
     //0x00};      //end
 
-typedef struct __attribute__((__packed__)) {
-    unsigned char blockSize;
+//frames are only split for threads if each piece gets at least this many pixels
+static const size_t MIN_SEGMENT_SIZE = 1 << 16;
+//codes collected from the LZW encoder before they are packed
+#define CODE_BUFFER_SIZE 1024
+//pixels of a bitmap expanded to color indices at a time
+#define EXPAND_BUFFER_SIZE 512
+//lossy thresholds a size budget can pick from, BUDGET_STEP apart
+#define BUDGET_LEVELS 17
+static const unsigned int BUDGET_STEP = 10;
+
+/**
+ * Pixels of a frame stored row by row in the caller's memory
+ */
+typedef struct {
+    const char *data;  //first pixel, or the byte holding it for a bitmap
+    size_t stride;     //bytes from the start of one row to the next
+    size_t width;
+    size_t height;
+    const unsigned char *colors; //color index of 0 and 1 bits, NULL if each
+                                 //pixel is a byte
+    int bitOffset;     //bit of the first byte holding the first pixel
+} FrameView;
+
+/**
+ * How far the colors of an image may be changed to compress it better
+ */
+typedef struct {
+    const LZWLossyTable *table;   //NULL for lossless
+    unsigned int threshold;
+    int exact;                    //the transparent index, -1 for none
+} Lossy;
+
+/**
+ * LZW codes packed least significant bit first, as gif stores them
+ */
+typedef struct {
     unsigned char *data;
-} DataBlock;
+    size_t size;     //bytes allocated
+    uint64_t numBits; //bits written
+} BitBuffer;
 
 typedef struct __attribute__((__packed__)) {
     //Graphic Control Extension Block
@@ -48,10 +88,64 @@ typedef struct __attribute__((__packed__)) {
 
     //image data
     char LZWMinCodeSize;
-    DataBlock *imageData;
-    size_t numBlocks;
+    unsigned char *imageData; //split into sub-blocks when written
+    size_t dataSize;
 } Image;
 
+/**
+ * A frame being added a few rows at a time
+ */
+typedef struct {
+    Image img;          //header, and the data if there is no sink
+    LZWEncoder enc;
+    BitBuffer bits;     //packed codes that have not been written yet
+    uint16_t nextCode;  //follows the decoder's table to size the codes
+    int codeSize;
+    unsigned short rowsLeft;
+} StreamFrame;
+
+/**
+ * An image compressed on the pool by GIF_QueueImage
+ */
+typedef struct {
+    const struct Gif_priv *gif;
+    FrameView frame;
+    Image img;
+    Lossy lossy;         //chosen when the image was queued
+    GIF_ReleaseFunc release;
+    void *user;
+    int done;            //set by the task while holding the queue's lock
+} QueuedImage;
+
+/**
+ * Images being compressed in the background, kept in the order they were
+ * queued so they are stored in that order
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t finished; //signalled each time an image is done
+    QueuedImage *images;     //ring buffer
+    size_t capacity;
+    size_t first;
+    size_t count;
+} ImageQueue;
+
+/**
+ * Tracks the bytes of a gif that has to stay under a size limit
+ */
+typedef struct {
+    size_t maxBytes;
+    size_t expectedFrames;  //frames the caller plans to add
+    size_t framesSeen;      //frames added so far, kept or dropped
+    uint64_t usedBytes;     //bytes of the images stored, not the header
+    int level;              //lossy threshold of the next frames, in steps
+    int skipping;           //1 after a frame was dropped for lack of room,
+                            //until a frame covers the whole canvas
+    LZWLossyTable *tables[BUDGET_LEVELS]; //made the first time a level is used
+    Image pending;          //the last kept image, held back so it can be
+    int hasPending;         //dropped if the next one covers it
+} Budget;
+
 //gif89a specification http://www.w3.org/Graphics/GIF/spec-gif89a.txt
 struct __attribute__((__packed__)) Gif_priv {
     //header
@@ -66,197 +160,830 @@ struct __attribute__((__packed__)) Gif_priv {
     char aspectRatio;              //pixel aspect ratio
 
     const char *colorTable;        //pointer to the global color table
-    Image *images;                 //headers and data for each frame
-    size_t numFrames;
-    unsigned short repeatTimes;
+    Image *images;                 //headers and data for each frame, unless
+    size_t numFrames;              //they went to the sink
+    size_t numStored;              //frames stored either way
+    int repeatTimes;               //-1 for no looping extension
+
+    Pool *pool;                    //threads for compressing frame segments
+    unsigned int numThreads;
+
+    //settings for the images added next
+    GIF_ClearStrategy clearStrategy;
+    char gceFlags;
+    char transparentColor;
+    unsigned int lossyThreshold;
+    LZWLossyTable *lossyTable;     //NULL for lossless
+    Budget *budget;                //size limit from GIF_SetBudget, or NULL
+
+    GIF_WriteFunc sink;            //writes the file as it is made, NULL to
+    void *sinkData;                //keep the images for GIF_Write
+    int headerWritten;
+    int sinkFailed;                //1 once a write to the sink came up short
+    StreamFrame *stream;           //frame started by GIF_BeginFrame, or NULL
+    ImageQueue *queue;             //images from GIF_QueueImage, or NULL
 };
 
-static void imageInit(const Gif *gif, Image *img, const unsigned short delayTime) {
-    //all of our frames fill the screen
-    img->x = img->y = 0;
-    img->width = gif->width;
-    img->height = gif->height;
+static void imageInit(const Gif *gif, Image *img, const unsigned short x,
+                      const unsigned short y, const unsigned short width,
+                      const unsigned short height, const unsigned short delayTime) {
+    img->x = x;
+    img->y = y;
+    img->width = width;
+    img->height = height;
 
     img->separator = SEPARATOR;
     img->imgFlags = 0;
-    img->LZWMinCodeSize = (gif->flags & 0xF) + 1; 
 
     //GCE data
     img->introducer = INTRODUCER;
     img->label = GCE_LABEL;
     img->size = 4;            //there are 4 bytes in this header
-    img->gceFlags = 0;
+    img->gceFlags = gif->gceFlags;
     img->delayTime = delayTime; //hundredths of a second
-    img->transparentColor = 0;
+    img->transparentColor = gif->transparentColor;
     img->gceTerminator = 0;
 }
 
-static int getBitsInNum(int num) {
-    return floor(log(num)/log(2)) + 1;
+/**
+ * Appends a code to the buffer, growing it if necessary
+ *
+ * @param buf buffer to write to
+ * @param code value to write
+ * @param codeSize number of bits to write the value with
+ */
+static void putCode(BitBuffer *buf, const uint16_t code, const int codeSize) {
+    //a code can touch up to 3 bytes past the current one
+    if(buf->numBits / 8 + 3 > buf->size) {
+        size_t newSize = buf->size > 0 ? 2 * buf->size : 256;
+        buf->data = realloc(buf->data, newSize);
+        memset(buf->data + buf->size, 0, newSize - buf->size);
+        buf->size = newSize;
+    }
+
+    unsigned char *dst = buf->data + buf->numBits / 8;
+    uint32_t bits = (uint32_t) code << (buf->numBits % 8);
+    dst[0] |= bits;
+    dst[1] |= bits >> 8;
+    dst[2] |= bits >> 16;
+    buf->numBits += codeSize;
 }
 
 /**
- * Takes uncompressed color mappings and compresses it then packs it in the gif
- * data format until it has filled a block or used the last of the data in the
- * frame
- *
- * Frees lzwState when it runs out of data to compress
+ * Appends the bits of one buffer to another at bit granularity
+ */
+static void appendBits(BitBuffer *buf, const BitBuffer *src) {
+    size_t i;
+    for(i = 0; i < src->numBits / 8; i++) {
+        putCode(buf, src->data[i], 8);
+    }
+
+    int rest = src->numBits % 8;
+    if(rest != 0) {
+        putCode(buf, src->data[i] & ((1 << rest) - 1), rest);
+    }
+}
+
+/**
+ * Finds the smallest LZW minimum code size that covers every pixel of a frame
  *
- * @param frame data to compress
- * @param size size of the frame array
- * @param lzwState pre-initialized state used for this image
- * @param container the DataBlock to store the compressed data (dynamically
- * allocated)
- * @return the number of elements in the frame array used
- */
-static size_t packData(const char *frame, size_t size, LZW *lzwState, DataBlock *container) {
-    static char overflow = 0;
-    static char overflowSize = 0;
-    unsigned char *packedData = calloc(BLOCK_SIZE + 1, sizeof(char));
-    int bitsWritten = 0;
-    if(lzwState->dict == NULL) {
-        lzwState->codeSize = getBitsInNum(lzwState->alphabetSize + 1);
-    }
-    size_t packedIndex = 0;
-    size_t frameIndex = 0;
-    int writeSTOP = 0;
-
-    //printf("\n");
-    while((packedIndex < BLOCK_SIZE && frameIndex <= size) || writeSTOP) {
-        uint16_t code;
-        if(overflowSize != 0) {
-            code = overflow;
-            overflow = 0;
-            frameIndex--;
-        }else if(frameIndex < size) {
-            code = LZW_CompressOne(frame[frameIndex], lzwState);
-        }else if(!writeSTOP){
-            code = LZW_Free(lzwState); //write the last code
-            writeSTOP = 1;
-        }else{
-            code = lzwState->alphabetSize + 2; //write the stop code
-            writeSTOP = 0;
+ * @param frame pixels of the frame
+ * @return the code size, at least 2 as gif requires
+ */
+static char frameCodeSize(const FrameView *frame) {
+    unsigned char bits = 0;
+    if(frame->colors != NULL) {
+        bits = frame->colors[0] | frame->colors[1];
+    }else{
+        const unsigned char *row = (const unsigned char *) frame->data;
+        size_t x, y;
+        for(y = 0; y < frame->height; y++, row += frame->stride) {
+            for(x = 0; x < frame->width; x++) {
+                bits |= row[x];
+            }
         }
+    }
+
+    char minCodeSize = 2;
+    while(minCodeSize < 8 && (bits >> minCodeSize) != 0) {
+        minCodeSize++;
+    }
 
-        if(code == 0xFFFF) { //no code output
-            frameIndex++;
+    return minCodeSize;
+}
+
+/**
+ * Packs codes from the LZW encoder, following the decoder's code size
+ *
+ * The decoder adds a string for every code except the first after a clear and
+ * widens the codes when its table needs another bit. The clear code that
+ * starts a range (nextCode is 0 until then) is not written, the caller writes
+ * it.
+ *
+ * @param out buffer to append the codes to
+ * @param codes codes from the encoder
+ * @param numCodes number of codes
+ * @param minCodeSize the LZW minimum code size of the image
+ * @param nextCode the encoder's next free code
+ * @param codeSize the size of the next code
+ */
+static void putCodes(BitBuffer *out, const uint16_t *codes, const size_t numCodes,
+                     const char minCodeSize, uint16_t *nextCode, int *codeSize) {
+    const uint16_t clearCode = 1 << minCodeSize;
+
+    size_t i;
+    for(i = 0; i < numCodes; i++) {
+        if(codes[i] == clearCode) {
+            if(*nextCode != 0) {
+                putCode(out, clearCode, *codeSize);
+            }
+            *nextCode = clearCode + 2;
+            *codeSize = minCodeSize + 1;
             continue;
         }
 
-        if(code == lzwState->alphabetSize + 1) {
-            frameIndex--; //do the same code again, we got the clear code
-            lzwState->codeSize = getBitsInNum(lzwState->alphabetSize + 1);
+        putCode(out, codes[i], *codeSize);
+        if(*nextCode < MAX_INDEX) {
+            (*nextCode)++;
+            if((*nextCode - 1) >> *codeSize) {
+                (*codeSize)++;
+            }
         }
+    }
+}
 
-        int bitsInNum = getBitsInNum(code);
-        if(overflowSize != 0) {
-            bitsInNum = overflowSize;
-            overflowSize = 0;
-        }
+/**
+ * Converts pixels of a bitmap row to color indices
+ *
+ * Whole bytes are spread to 8 pixels at once: multiplying copies the byte to
+ * every lane, the mask keeps bit k in lane k and adding 0x7F carries it to the
+ * top of the lane.
+ *
+ * @param frame the bitmap
+ * @param row first byte of the row
+ * @param col column of the first pixel to convert
+ * @param n number of pixels
+ * @param out receives n color indices
+ */
+static void expandBits(const FrameView *frame, const unsigned char *row, size_t col,
+                       size_t n, char *out) {
+    const unsigned char color0 = frame->colors[0];
+    const unsigned char flip = frame->colors[0] ^ frame->colors[1];
+    size_t bit = frame->bitOffset + col;
+    size_t i = 0;
 
-        if(bitsInNum < lzwState->codeSize) {
-            bitsInNum = lzwState->codeSize;
-        }else{
-            lzwState->codeSize = bitsInNum;
-            //printf("top: %d, %d\n", frameIndex, lzwState->codeSize);
+    for(; i < n && (bit & 7) != 0; i++, bit++) {
+        out[i] = ((row[bit >> 3] >> (bit & 7)) & 1) ? frame->colors[1] : color0;
+    }
+
+    for(; i + 8 <= n; i += 8, bit += 8) {
+        uint64_t lanes = row[bit >> 3] * 0x0101010101010101ULL;
+        lanes = (((lanes & 0x8040201008040201ULL) + 0x7F7F7F7F7F7F7F7FULL) >> 7) &
+                0x0101010101010101ULL;
+        lanes = (lanes * flip) ^ (color0 * 0x0101010101010101ULL);
+
+        int k;
+        for(k = 0; k < 8; k++) {
+            out[i + k] = lanes >> (8 * k);
         }
+    }
 
-        //printf("code: %x, size: %d\n", code, lzwState->codeSize);
+    for(; i < n; i++, bit++) {
+        out[i] = ((row[bit >> 3] >> (bit & 7)) & 1) ? frame->colors[1] : color0;
+    }
+}
 
-        if(bitsInNum <= 8 - bitsWritten) {
-            packedData[packedIndex] |= code << bitsWritten;
-            bitsWritten += bitsInNum;
+/**
+ * Compresses pixels with the encoder and packs the codes
+ */
+static void compressPixels(LZWEncoder *enc, const char *pixels, size_t n,
+                           const char minCodeSize, BitBuffer *out,
+                           uint16_t *nextCode, int *codeSize) {
+    uint16_t codes[CODE_BUFFER_SIZE];
+    while(n > 0) {
+        size_t written;
+        size_t used = LZW_CompressChunk(enc, pixels, n, codes, CODE_BUFFER_SIZE, &written);
+        putCodes(out, codes, written, minCodeSize, nextCode, codeSize);
+        pixels += used;
+        n -= used;
+    }
+}
 
-            if(bitsWritten == 8) {
-                bitsWritten = 0;
-                packedIndex++;
-            }
+/**
+ * Compresses a range of pixels with a fresh dictionary
+ *
+ * The clear code that starts the range is not written, the caller writes it
+ * with the code size the previous range ended with.
+ *
+ * @param frame frame to compress
+ * @param start index of the first pixel of the range (in row order)
+ * @param size number of pixels
+ * @param minCodeSize the LZW minimum code size of the image
+ * @param clearWhenFull 1 to clear the dictionary when it fills, 0 to keep it
+ * @param lossy how far colors may be changed
+ * @param out buffer to append the codes to
+ * @param codeSize returns the code size at the end of the range
+ */
+static void compressRange(const FrameView *frame, uint64_t start, uint64_t size,
+                          const char minCodeSize, const int clearWhenFull,
+                          const Lossy *lossy, BitBuffer *out, int *codeSize) {
+    LZWEncoder enc;
+    LZW_EncoderInit(&enc, (1 << minCodeSize) - 1);
+    enc.clearWhenFull = clearWhenFull;
+    LZW_EncoderSetLossy(&enc, lossy->table, lossy->exact);
+    uint16_t nextCode = 0;
+    *codeSize = minCodeSize + 1;
+
+    if(size == 0) {
+        return;
+    }
+
+    //read directly from the caller's rows
+    size_t col = start % frame->width;
+    const char *row = frame->data + (start / frame->width) * frame->stride;
+
+    while(size > 0) {
+        size_t n = frame->width - col < size ? frame->width - col : size;
+        size -= n;
+
+        if(frame->colors == NULL) {
+            compressPixels(&enc, row + col, n, minCodeSize, out, &nextCode, codeSize);
         }else{
-            int bitsUsed = 0;
-            while(bitsUsed != bitsInNum) {
-                int bitsToWrite = ((bitsInNum - bitsUsed) <= 8 - bitsWritten) ?
-                        (bitsInNum - bitsUsed) : (8 - bitsWritten);
-                int mask = ((1 << bitsToWrite) - 1) << bitsUsed;
-                int num = (code & mask) >> bitsUsed;
-
-                packedData[packedIndex] |= num << bitsWritten;
-                bitsWritten += bitsToWrite;
-                bitsUsed += bitsToWrite;
-
-                if(bitsWritten == 8) {
-                    bitsWritten = 0;
-                    packedIndex++;
-
-                    if(packedIndex == BLOCK_SIZE) {
-                        overflow = code >> bitsUsed;
-                        overflowSize = bitsInNum - bitsUsed;
-                        break;
-                    }
-                }
+            //expand a piece of the bitmap row at a time
+            char expanded[EXPAND_BUFFER_SIZE];
+            size_t done;
+            for(done = 0; done < n; done += EXPAND_BUFFER_SIZE) {
+                size_t count = n - done < EXPAND_BUFFER_SIZE ? n - done : EXPAND_BUFFER_SIZE;
+                expandBits(frame, (const unsigned char *) row, col + done, count, expanded);
+                compressPixels(&enc, expanded, count, minCodeSize, out, &nextCode, codeSize);
             }
         }
 
-        frameIndex++;
-        if(code != 0xffff) {
-            lzwState->codeSize = getBitsInNum(lzwState->dict->currIndex - 1);
-            //printf("bottom: %d, %d\n", lzwState->dict->currIndex, lzwState->codeSize);
-        }
+        col = 0;
+        row += frame->stride;
     }
 
-    //if the above for loop limits at BLOCK_SIZE this will always be false
-    if(bitsWritten != 0) {
-        packedIndex++;
+    //the decoder adds one more entry after reading the last code
+    uint16_t codes[1];
+    size_t written = LZW_CompressFinish(&enc, codes, 1);
+    putCodes(out, codes, written, minCodeSize, &nextCode, codeSize);
+}
+
+/**
+ * Compresses a range of pixels with the gif's clear strategy
+ *
+ * @see compressRange
+ * @param strategy when to clear the dictionary
+ */
+static void compressSegment(const FrameView *frame, uint64_t start, uint64_t size,
+                            const char minCodeSize, const GIF_ClearStrategy strategy,
+                            const Lossy *lossy, BitBuffer *out, int *codeSize) {
+    if(strategy != GIF_CLEAR_BEST) {
+        compressRange(frame, start, size, minCodeSize,
+                      strategy == GIF_CLEAR_WHEN_FULL, lossy, out, codeSize);
+        return;
     }
 
-    container->data = realloc(packedData, packedIndex);
-    container->blockSize = packedIndex;
+    BitBuffer clearing = {NULL, 0, 0};
+    BitBuffer keeping = {NULL, 0, 0};
+    int clearingSize, keepingSize;
+    compressRange(frame, start, size, minCodeSize, 1, lossy, &clearing, &clearingSize);
+    compressRange(frame, start, size, minCodeSize, 0, lossy, &keeping, &keepingSize);
 
-    return frameIndex;
+    if(keeping.numBits < clearing.numBits) {
+        appendBits(out, &keeping);
+        *codeSize = keepingSize;
+    }else{
+        appendBits(out, &clearing);
+        *codeSize = clearingSize;
+    }
+
+    free(clearing.data);
+    free(keeping.data);
+}
+
+typedef struct {
+    const FrameView *frame;
+    uint64_t start;
+    uint64_t size;
+    char minCodeSize;
+    GIF_ClearStrategy strategy;
+    Lossy lossy;
+    BitBuffer bits;
+    int codeSize;
+} Segment;
+
+static void compressSegmentTask(void *arg) {
+    Segment *segment = arg;
+    compressSegment(segment->frame, segment->start, segment->size,
+                    segment->minCodeSize, segment->strategy, &segment->lossy,
+                    &segment->bits, &segment->codeSize);
+}
+
+/**
+ * @return the number of pieces a frame of size pixels is compressed in
+ */
+static size_t countSegments(const Gif *gif, const uint64_t size) {
+    size_t numSegments = gif->pool != NULL ? gif->numThreads : 1;
+    if(size / numSegments < MIN_SEGMENT_SIZE) {
+        numSegments = size / MIN_SEGMENT_SIZE;
+    }
+
+    return numSegments > 0 ? numSegments : 1;
 }
 
 /**
- * Takes a frame and converts it to an array of compressed and packed data
- * blocks in the gif format.
+ * Hashes everything that determines the compressed data of a frame
  *
+ * @param frame pixels of the frame
+ * @param minCodeSize LZW minimum code size of the image
+ * @param numSegments number of pieces the frame is compressed in
+ * @param strategy when the dictionary is cleared
+ * @param lossy how far colors may be changed
+ * @return the key to look the compressed data up in the cache with
+ */
+static CacheKey frameKey(const FrameView *frame, const char minCodeSize,
+                         const size_t numSegments, const GIF_ClearStrategy strategy,
+                         const Lossy *lossy) {
+    //bitmaps also depend on their colors and where the first pixel is
+    const uint64_t bitmap = frame->colors == NULL ? 0 :
+            1 | frame->colors[0] << 8 | frame->colors[1] << 16 | frame->bitOffset << 24;
+    const uint64_t settings[8] = {frame->width, frame->height, minCodeSize, numSegments,
+                                  strategy, bitmap, lossy->threshold, lossy->exact + 1};
+    unsigned char header[sizeof(settings)];
+    size_t i;
+    for(i = 0; i < sizeof(settings); i++) { //fixed byte order
+        header[i] = settings[i / 8] >> (8 * (i % 8));
+    }
+
+    CacheHasher hasher;
+    cache_hashInit(&hasher);
+    cache_hashUpdate(&hasher, header, sizeof(header));
+    if(lossy->table != NULL) {
+        //lossy matches depend on the colors, which differ between gifs
+        cache_hashUpdate(&hasher, lossy->table->palette, sizeof(lossy->table->palette));
+    }
+
+    const size_t rowSize = frame->colors == NULL ? frame->width :
+            (frame->bitOffset + frame->width + 7) / 8;
+    const char *row = frame->data;
+    for(i = 0; i < frame->height; i++, row += frame->stride) {
+        cache_hashUpdate(&hasher, row, rowSize);
+    }
+
+    return cache_hashFinal(&hasher);
+}
+
+/**
+ * @return the image's transparent index, -1 if it has none
+ */
+static int transparentIndex(const Image *img) {
+    return (img->gceFlags & 0x1) ? (unsigned char) img->transparentColor : -1;
+}
+
+/**
+ * @return the lossy settings of a size budget level, making its table the
+ * first time it is used
+ */
+static Lossy budgetLossy(Gif *gif, const Image *img, const int level) {
+    Budget *budget = gif->budget;
+    if(level > 0 && budget->tables[level] == NULL) {
+        budget->tables[level] = malloc(sizeof(LZWLossyTable));
+        LZW_LossyTableInit(budget->tables[level], (const unsigned char *) gif->colorTable,
+                           1 << ((gif->flags & 0x7) + 1), level * BUDGET_STEP);
+    }
+
+    Lossy lossy;
+    lossy.table = budget->tables[level];
+    lossy.threshold = level * BUDGET_STEP;
+    lossy.exact = transparentIndex(img);
+    return lossy;
+}
+
+/**
+ * @return the lossy settings for compressing an image of the gif now, from
+ * the size budget if there is one
+ */
+static Lossy imageLossy(Gif *gif, const Image *img) {
+    if(gif->budget != NULL) {
+        return budgetLossy(gif, img, gif->budget->level);
+    }
+
+    Lossy lossy;
+    lossy.table = gif->lossyTable;
+    lossy.threshold = gif->lossyThreshold;
+    lossy.exact = transparentIndex(img);
+    return lossy;
+}
+
+/**
+ * Compresses a frame into the LZW code stream of an image
+ *
+ * If the gif has threads and the frame is big enough it is cut into pixel
+ * ranges that are compressed in parallel, each with its own dictionary, and
+ * joined with clear codes. Otherwise the frame is compressed in one piece.
+ * If the cache is on, frames that were compressed before (by any gif) are
+ * copied from it instead.
+ *
+ * @param gif gif the frame belongs to
  * @param frame frame to encode
- * @param size size of the frame
- * @param codeSize initial code size to use for compressing
- * @param container return value, array to store the blocks in
- * @return number of blocks created
+ * @param img image to store the compressed data in
+ * @param split 1 to let the frame be split across the gif's threads, 0 if
+ * they are busy with other frames
+ * @param lossy how far colors may be changed
  */
-static size_t splitDataBlocks(const char *frame, size_t size, const char codeSize, DataBlock **container) {
-    //TODO: do size doubling for speed (instead of reallocing by 1 each time)
-    //allocate an array of data blocks
-    DataBlock *result = malloc(1);
-    LZW lzwState;
-    LZW_Init((1 << codeSize) - 1, &lzwState);
+static void compressImage(const Gif *gif, const FrameView *frame, Image *img,
+                          const int split, const Lossy *lossy) {
+    const uint64_t size = (uint64_t) frame->width * frame->height;
+    const uint16_t clearCode = 1 << img->LZWMinCodeSize;
+    BitBuffer result = {NULL, 0, 0};
+    int codeSize = img->LZWMinCodeSize + 1;
+    const size_t numSegments = split ? countSegments(gif, size) : 1;
 
-    //copy all the blocks that fill the max size
-    int frameIndex = 0;
-    int blockIndex = 0;
-    while(frameIndex <= size) {
-        result = realloc(result, sizeof(DataBlock) * (blockIndex + 1));
-        int numUsed = packData(frame + frameIndex, size - frameIndex, &lzwState, result + blockIndex);
+    CacheKey key;
+    const int useCache = cache_enabled();
+    if(useCache) {
+        unsigned char *data;
+        size_t dataSize;
+        key = frameKey(frame, img->LZWMinCodeSize, numSegments, gif->clearStrategy, lossy);
+        if(cache_lookup(&key, &data, &dataSize)) {
+            img->imageData = data;
+            img->dataSize = dataSize;
+            return;
+        }
+    }
+
+    putCode(&result, clearCode, codeSize);
+    if(numSegments <= 1) {
+        compressSegment(frame, 0, size, img->LZWMinCodeSize, gif->clearStrategy,
+                        lossy, &result, &codeSize);
+    }else{
+        Segment *segments = malloc(sizeof(Segment) * numSegments);
+
+        size_t i;
+        for(i = 0; i < numSegments; i++) {
+            segments[i].frame = frame;
+            segments[i].start = size * i / numSegments;
+            segments[i].size = size * (i + 1) / numSegments - segments[i].start;
+            segments[i].minCodeSize = img->LZWMinCodeSize;
+            segments[i].strategy = gif->clearStrategy;
+            segments[i].lossy = *lossy;
+            segments[i].bits.data = NULL;
+            segments[i].bits.size = segments[i].bits.numBits = 0;
+            pool_submit(gif->pool, compressSegmentTask, segments + i);
+        }
+        pool_wait(gif->pool);
 
-        frameIndex += numUsed;
-        blockIndex++;
+        for(i = 0; i < numSegments; i++) {
+            if(i != 0) {
+                putCode(&result, clearCode, codeSize);
+            }
+            appendBits(&result, &segments[i].bits);
+            codeSize = segments[i].codeSize;
+            free(segments[i].bits.data);
+        }
+
+        free(segments);
     }
+    putCode(&result, clearCode + 1, codeSize); //stop code
 
-    *container = result;
-    return blockIndex;
+    img->dataSize = (result.numBits + 7) / 8;
+    img->imageData = realloc(result.data, img->dataSize);
+
+    if(useCache) {
+        cache_insert(&key, img->imageData, img->dataSize);
+    }
 }
 
 static void freeImage(Image *image) {
+    free(image->imageData);
+}
+
+/**
+ * Writes the header, color table and looping extension
+ */
+static int writeHeader(const Gif *gif, GIF_WriteFunc write, void *data) {
+    //color table size is 3*(2^(colorSizeFlag + 1)) (3 bytes per color)
+    const size_t colorTableSize = 3*(1 << ((gif->flags & 0xf) + 1));
+    int ok = write(gif, offsetof(Gif, colorTable), data) == offsetof(Gif, colorTable) &&
+            write(gif->colorTable, colorTableSize, data) == colorTableSize;
+
+    if(gif->repeatTimes >= 0) {
+        char repeat[19];
+        memcpy(repeat, REPEAT_HEADER, REPEAT_HEADER_SIZE);
+        repeat[16] = gif->repeatTimes & 0xFF; //repeatTimes is little endian
+        repeat[17] = gif->repeatTimes >> 8;
+        repeat[18] = 0x00;                    //end header
+        ok = ok && write(repeat, sizeof(repeat), data) == sizeof(repeat);
+    }
+
+    return ok;
+}
+
+/**
+ * Writes image data as sub-blocks
+ *
+ * @param write function to write with
+ * @param data argument for the function
+ * @param bytes image data
+ * @param size number of bytes
+ * @param end 1 to write the terminator after the last block
+ * @return 1 if every write succeeded
+ */
+static int writeSubBlocks(GIF_WriteFunc write, void *data, const unsigned char *bytes,
+                          const size_t size, const int end) {
+    int ok = 1;
+    size_t i;
+    for(i = 0; i < size; i += BLOCK_SIZE) {
+        unsigned char blockSize = size - i < BLOCK_SIZE ? size - i : BLOCK_SIZE;
+        ok = ok && write(&blockSize, 1, data) == 1 &&
+                write(bytes + i, blockSize, data) == blockSize;
+    }
+
+    if(end) {
+        const unsigned char terminator = 0x00; //block separator
+        ok = ok && write(&terminator, 1, data) == 1;
+    }
+
+    return ok;
+}
+
+/**
+ * Writes a whole image, the graphic control extension through the data
+ */
+static int writeImage(const Image *img, GIF_WriteFunc write, void *data) {
+    return write(img, offsetof(Image, imageData), data) == offsetof(Image, imageData) &&
+            writeSubBlocks(write, data, img->imageData, img->dataSize, 1);
+}
+
+/**
+ * Writes the header to the sink before the first image
+ */
+static void startSink(Gif *gif) {
+    if(!gif->headerWritten) {
+        gif->sinkFailed |= !writeHeader(gif, gif->sink, gif->sinkData);
+        gif->headerWritten = 1;
+    }
+}
+
+/**
+ * @return the bytes an image takes in the file, with its sub-block headers
+ */
+static uint64_t imageBytes(const Image *img) {
+    return offsetof(Image, imageData) + img->dataSize +
+            (img->dataSize + BLOCK_SIZE - 1) / BLOCK_SIZE + 1;
+}
+
+/**
+ * Sends a finished image to the sink, or keeps it for GIF_Write
+ */
+static void storeImage(Gif *gif, Image *img) {
+    gif->numStored++;
+    if(gif->budget != NULL) {
+        gif->budget->usedBytes += imageBytes(img);
+    }
+
+    if(gif->sink != NULL) {
+        startSink(gif);
+        gif->sinkFailed |= !writeImage(img, gif->sink, gif->sinkData);
+        freeImage(img);
+    }else{
+        //TODO: find a way to allow a static array size from the beginning for speed
+        //resize the images array
+        if(gif->numFrames == 0 || gif->images == NULL) {
+            gif->images = malloc(sizeof(Image));
+        }else{
+            gif->images = realloc(gif->images, sizeof(Image) * (gif->numFrames + 1));
+        }
+        gif->images[gif->numFrames] = *img;
+        gif->numFrames++;
+    }
+}
+
+/**
+ * @return the bytes of the header, color table and looping extension
+ */
+static uint64_t headerBytes(const Gif *gif) {
+    return offsetof(Gif, colorTable) + 3*(1 << ((gif->flags & 0x7) + 1)) +
+            (gif->repeatTimes >= 0 ? sizeof(REPEAT_HEADER) : 0);
+}
+
+/**
+ * @return 1 if nothing drawn before the image shows through it
+ */
+static int coversCanvas(const Gif *gif, const Image *img) {
+    return img->x == 0 && img->y == 0 && img->width == gif->width &&
+            img->height == gif->height && transparentIndex(img) < 0;
+}
+
+static unsigned short addDelay(const unsigned short a, const unsigned short b) {
+    return a + b < 0xFFFF ? a + b : 0xFFFF;
+}
+
+/**
+ * Stores the image held back by the size budget
+ */
+static void flushPending(Gif *gif) {
+    if(gif->budget != NULL && gif->budget->hasPending) {
+        gif->budget->hasPending = 0;
+        storeImage(gif, &gif->budget->pending);
+    }
+}
+
+/**
+ * Stores a compressed image, keeping the gif under its size budget
+ *
+ * Each frame may use the bytes left shared evenly over the frames left. A
+ * frame over that is compressed once more at a lossy threshold raised by how
+ * far over it was, and the raised threshold is kept for the next frames;
+ * frames well under lower it a step. The last image is held back: if the
+ * threshold is at its highest and the gif is still behind, or there is no
+ * room for both, it is swapped for the new image when that covers it and
+ * fits on its own, and the new image also shows for its time. Otherwise an
+ * image with no room is dropped and the last one shows for its time.
+ *
+ * @param gif gif to add the image to
+ * @param frame pixels of the image, to compress it again
+ * @param img the compressed image
+ * @param split 1 if compressing again may use the gif's threads
+ */
+static void keepImage(Gif *gif, const FrameView *frame, Image *img, const int split) {
+    Budget *budget = gif->budget;
+    if(budget == NULL) {
+        storeImage(gif, img);
+        return;
+    }
+
+    budget->framesSeen++;
+    const size_t framesLeft = budget->expectedFrames >= budget->framesSeen ?
+            budget->expectedFrames - budget->framesSeen + 1 : 1;
+    uint64_t pendingBytes = budget->hasPending ? imageBytes(&budget->pending) : 0;
+    //the header, the images so far and the trailer
+    const uint64_t committed = headerBytes(gif) + budget->usedBytes + 1;
+    const uint64_t allowance = committed + pendingBytes < budget->maxBytes ?
+            (budget->maxBytes - committed - pendingBytes) / framesLeft : 0;
+
+    uint64_t size = imageBytes(img);
+    if(size > allowance && budget->level < BUDGET_LEVELS - 1) {
+        //one more try, a step higher for every quarter of the allowance over
+        const uint64_t steps = allowance > 0 ? 1 + 4 * (size - allowance) / allowance : BUDGET_LEVELS;
+        const int level = budget->level + steps < BUDGET_LEVELS - 1 ?
+                budget->level + (int) steps : BUDGET_LEVELS - 1;
+
+        Image retry = *img;
+        const Lossy lossy = budgetLossy(gif, img, level);
+        compressImage(gif, frame, &retry, split, &lossy);
+        if(imageBytes(&retry) < size) {
+            freeImage(img);
+            *img = retry;
+            size = imageBytes(img);
+        }else{
+            freeImage(&retry);
+        }
+        budget->level = level;
+    }else if(size < allowance / 2 && budget->level > 0) {
+        budget->level--;
+    }
+
+    const int covers = coversCanvas(gif, img);
+    if(covers) {
+        budget->skipping = 0;
+    }
+
+    if(budget->hasPending && covers) {
+        const uint64_t schedule = budget->expectedFrames > 0 ?
+                (uint64_t) budget->maxBytes * (budget->framesSeen - 1) / budget->expectedFrames :
+                budget->maxBytes;
+        const int behind = budget->level == BUDGET_LEVELS - 1 &&
+                committed + pendingBytes > schedule;
+        if((behind || committed + pendingBytes + size > budget->maxBytes) &&
+                committed + size <= budget->maxBytes) {
+            //nothing of the held back image shows through this one
+            img->delayTime = addDelay(img->delayTime, budget->pending.delayTime);
+            freeImage(&budget->pending);
+            budget->hasPending = 0;
+            pendingBytes = 0;
+        }
+    }
+
+    if(budget->hasPending &&
+            (budget->skipping || committed + pendingBytes + size > budget->maxBytes)) {
+        //later images may only change part of this one, drop them until one
+        //covers the whole canvas
+        budget->pending.delayTime = addDelay(budget->pending.delayTime, img->delayTime);
+        freeImage(img);
+        budget->skipping = 1;
+        return;
+    }
+
+    flushPending(gif);
+    budget->pending = *img;
+    budget->hasPending = 1;
+}
+
+/**
+ * @return 1 if the images stored so far already make the gif bigger than its
+ * budget
+ */
+static int overBudget(const Gif *gif) {
+    return gif->budget != NULL &&
+            headerBytes(gif) + gif->budget->usedBytes + 1 > gif->budget->maxBytes;
+}
+
+static void freeBudget(Gif *gif) {
+    if(gif->budget == NULL) {
+        return;
+    }
+
+    if(gif->budget->hasPending) {
+        freeImage(&gif->budget->pending);
+    }
+
     int i;
-    for(i = 0; i < image->numBlocks; i++) {
-        free(image->imageData[i].data);
+    for(i = 0; i < BUDGET_LEVELS; i++) {
+        free(gif->budget->tables[i]);
     }
+    free(gif->budget);
+    gif->budget = NULL;
+}
 
-    free(image->imageData);
+/**
+ * Pool task for one queued image, the whole frame is one segment because the
+ * other threads are busy with the images queued around it
+ */
+static void compressQueuedTask(void *arg) {
+    QueuedImage *queued = arg;
+    queued->img.LZWMinCodeSize = frameCodeSize(&queued->frame);
+    compressImage(queued->gif, &queued->frame, &queued->img, 0, &queued->lossy);
+
+    ImageQueue *queue = queued->gif->queue;
+    pthread_mutex_lock(&queue->lock);
+    queued->done = 1;
+    pthread_cond_broadcast(&queue->finished);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * Stores the queued images that are done, oldest first
+ *
+ * @param gif gif with queued images
+ * @param maxLeft wait until at most this many images are still queued
+ */
+static void collectQueue(Gif *gif, const size_t maxLeft) {
+    ImageQueue *queue = gif->queue;
+    if(queue == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    while(queue->count > 0) {
+        QueuedImage *queued = queue->images + queue->first;
+        if(!queued->done) {
+            if(queue->count <= maxLeft) {
+                break;
+            }
+            pthread_cond_wait(&queue->finished, &queue->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&queue->lock);
+
+        //the images after it may still be compressing, the slot is not reused
+        //until it is removed
+        keepImage(gif, &queued->frame, &queued->img, 0);
+        if(queued->release != NULL) {
+            queued->release((const unsigned char *) queued->frame.data, queued->user);
+        }
+
+        pthread_mutex_lock(&queue->lock);
+        queue->first = (queue->first + 1) % queue->capacity;
+        queue->count--;
+    }
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * Stores every queued image and frees the queue
+ */
+static void finishQueue(Gif *gif) {
+    if(gif->queue == NULL) {
+        return;
+    }
+
+    collectQueue(gif, 0);
+
+    pthread_mutex_destroy(&gif->queue->lock);
+    pthread_cond_destroy(&gif->queue->finished);
+    free(gif->queue->images);
+    free(gif->queue);
+    gif->queue = NULL;
+}
+
+static size_t fileWrite(const void *bytes, size_t size, void *file) {
+    return fwrite(bytes, 1, size, file);
 }
 
 Gif *GIF_Init(const unsigned short width, const unsigned short height,
-              const unsigned char *colorTable, const unsigned char numColors,
+              const unsigned char *colorTable, const unsigned short numColors,
               const unsigned short numRepeats) {
     Gif *gif = malloc(sizeof(Gif));
 
@@ -273,30 +1000,379 @@ Gif *GIF_Init(const unsigned short width, const unsigned short height,
     gif->colorTable = colorTable;
     gif->images = NULL;
     gif->numFrames = 0;
-    gif->repeatTimes = numRepeats;
+    gif->numStored = 0;
+    gif->repeatTimes = numRepeats > 0 ? numRepeats : -1;
+
+    gif->pool = NULL;
+    gif->numThreads = 1;
+
+    gif->clearStrategy = GIF_CLEAR_WHEN_FULL;
+    gif->gceFlags = 0;
+    gif->transparentColor = 0;
+    gif->lossyThreshold = 0;
+    gif->lossyTable = NULL;
+    gif->budget = NULL;
+
+    gif->sink = NULL;
+    gif->sinkData = NULL;
+    gif->headerWritten = 0;
+    gif->sinkFailed = 0;
+    gif->stream = NULL;
+    gif->queue = NULL;
 
     return gif;
 }
 
+void GIF_SetSink(Gif *gif, GIF_WriteFunc sink, void *user) {
+    gif->sink = sink;
+    gif->sinkData = user;
+}
+
+void GIF_SetRepeat(Gif *gif, const int numRepeats) {
+    gif->repeatTimes = numRepeats >= 0 ? numRepeats : -1;
+}
+
+void GIF_SetClearStrategy(Gif *gif, const GIF_ClearStrategy strategy) {
+    finishQueue(gif); //queued images use the strategy they were queued with
+    gif->clearStrategy = strategy;
+}
+
+void GIF_SetFrameControl(Gif *gif, const GIF_Disposal disposal,
+                         const int transparentIndex) {
+    gif->gceFlags = (disposal & 0x7) << 2;
+    gif->transparentColor = 0;
+    if(transparentIndex >= 0) {
+        gif->gceFlags |= 0x1;
+        gif->transparentColor = transparentIndex;
+    }
+}
+
+void GIF_SetLossy(Gif *gif, const unsigned int threshold) {
+    finishQueue(gif); //queued images use the threshold they were queued with
+
+    gif->lossyThreshold = threshold;
+    if(threshold == 0) {
+        free(gif->lossyTable);
+        gif->lossyTable = NULL;
+        return;
+    }
+
+    if(gif->lossyTable == NULL) {
+        gif->lossyTable = malloc(sizeof(LZWLossyTable));
+    }
+    LZW_LossyTableInit(gif->lossyTable, (const unsigned char *) gif->colorTable,
+                       1 << ((gif->flags & 0x7) + 1), threshold);
+}
+
+void GIF_SetBudget(Gif *gif, const size_t maxBytes, const size_t expectedFrames) {
+    finishQueue(gif);
+    flushPending(gif);
+    freeBudget(gif);
+
+    if(maxBytes > 0) {
+        gif->budget = calloc(1, sizeof(Budget));
+        gif->budget->maxBytes = maxBytes;
+        gif->budget->expectedFrames = expectedFrames;
+    }
+}
+
+size_t GIF_PredictSize(const Gif *gif) {
+    const Budget *budget = gif->budget;
+    if(budget == NULL) {
+        return 0;
+    }
+
+    const uint64_t used = budget->usedBytes +
+            (budget->hasPending ? imageBytes(&budget->pending) : 0);
+    uint64_t size = headerBytes(gif) + used + 1;
+    if(budget->framesSeen > 0 && budget->expectedFrames > budget->framesSeen) {
+        size += used * (budget->expectedFrames - budget->framesSeen) / budget->framesSeen;
+    }
+
+    return size;
+}
+
+void GIF_SetThreads(Gif *gif, const unsigned int numThreads) {
+    finishQueue(gif);
+
+    if(gif->pool != NULL) {
+        pool_free(gif->pool);
+        gif->pool = NULL;
+    }
+
+    //frames are split for the threads that actually started
+    gif->numThreads = 1;
+    if(numThreads > 1) {
+        gif->pool = pool_init(numThreads);
+        if(gif->pool != NULL) {
+            gif->numThreads = pool_numThreads(gif->pool);
+        }
+    }
+}
+
 void GIF_AddImage(Gif *gif, const unsigned char *data, const unsigned short delayTime) {
-    //TODO: find a way to allow a static array size from the beginning for speed
-    //resize the images array
-    if(gif->numFrames == 0 || gif->images == NULL) {
-        gif->images = malloc(sizeof(Image));
+    GIF_AddImageStrided(gif, data, gif->width, 0, 0, gif->width, gif->height, delayTime);
+}
+
+void GIF_QueueImage(Gif *gif, const unsigned char *data, const unsigned short delayTime,
+                    GIF_ReleaseFunc release, void *user) {
+    if(gif->pool == NULL) {
+        GIF_AddImage(gif, data, delayTime);
+        if(release != NULL) {
+            release(data, user);
+        }
+        return;
+    }
+
+    if(gif->stream != NULL) {
+        GIF_EndFrame(gif);
+    }
+
+    if(gif->queue == NULL) {
+        //enough images to keep every thread busy while the oldest is stored
+        ImageQueue *queue = malloc(sizeof(ImageQueue));
+        pthread_mutex_init(&queue->lock, NULL);
+        pthread_cond_init(&queue->finished, NULL);
+        queue->capacity = 2 * gif->numThreads;
+        queue->images = malloc(sizeof(QueuedImage) * queue->capacity);
+        queue->first = queue->count = 0;
+        gif->queue = queue;
+    }
+
+    ImageQueue *queue = gif->queue;
+    collectQueue(gif, queue->capacity - 1);
+
+    QueuedImage *queued = queue->images + (queue->first + queue->count) % queue->capacity;
+    queued->gif = gif;
+    queued->frame.data = (const char *) data;
+    queued->frame.stride = gif->width;
+    queued->frame.width = gif->width;
+    queued->frame.height = gif->height;
+    queued->frame.colors = NULL;
+    queued->frame.bitOffset = 0;
+    imageInit(gif, &queued->img, 0, 0, gif->width, gif->height, delayTime);
+    queued->lossy = imageLossy(gif, &queued->img);
+    queued->release = release;
+    queued->user = user;
+    queued->done = 0;
+
+    pthread_mutex_lock(&queue->lock);
+    queue->count++;
+    pthread_mutex_unlock(&queue->lock);
+
+    pool_submit(gif->pool, compressQueuedTask, queued);
+}
+
+void GIF_FlushQueue(Gif *gif) {
+    finishQueue(gif);
+}
+
+/**
+ * Keeps a rectangle on the gif's screen
+ */
+static void clipRect(const Gif *gif, unsigned short *x, unsigned short *y,
+                     unsigned short *width, unsigned short *height) {
+    if(*x > gif->width) {
+        *x = gif->width;
+    }
+    if(*y > gif->height) {
+        *y = gif->height;
+    }
+    if(*width > gif->width - *x) {
+        *width = gif->width - *x;
+    }
+    if(*height > gif->height - *y) {
+        *height = gif->height - *y;
+    }
+}
+
+/**
+ * Compresses a frame and adds it as the next image
+ */
+static void addFrame(Gif *gif, const FrameView *frame, const unsigned short x,
+                     const unsigned short y, const unsigned short delayTime) {
+    finishQueue(gif);
+
+    Image img;
+    imageInit(gif, &img, x, y, frame->width, frame->height, delayTime);
+    img.LZWMinCodeSize = frameCodeSize(frame);
+    const Lossy lossy = imageLossy(gif, &img);
+    compressImage(gif, frame, &img, 1, &lossy);
+    keepImage(gif, frame, &img, 1);
+}
+
+void GIF_AddImageStrided(Gif *gif, const unsigned char *base, const size_t stride,
+                         unsigned short x, unsigned short y,
+                         unsigned short width, unsigned short height,
+                         const unsigned short delayTime) {
+    clipRect(gif, &x, &y, &width, &height);
+
+    FrameView frame;
+    frame.data = (const char *) base + (size_t) y * stride + x;
+    frame.stride = stride;
+    frame.width = width;
+    frame.height = height;
+    frame.colors = NULL;
+    frame.bitOffset = 0;
+    addFrame(gif, &frame, x, y, delayTime);
+}
+
+void GIF_AddBitmap(Gif *gif, const unsigned char *bits, const size_t stride,
+                   const unsigned char colors[2],
+                   unsigned short x, unsigned short y,
+                   unsigned short width, unsigned short height,
+                   const unsigned short delayTime) {
+    clipRect(gif, &x, &y, &width, &height);
+
+    FrameView frame;
+    frame.data = (const char *) bits + (size_t) y * stride + x / 8;
+    frame.stride = stride;
+    frame.width = width;
+    frame.height = height;
+    frame.colors = colors;
+    frame.bitOffset = x % 8;
+    addFrame(gif, &frame, x, y, delayTime);
+}
+
+/**
+ * Writes the sub-blocks that are full and keeps the bits after them
+ */
+static void flushStream(Gif *gif, StreamFrame *stream) {
+    const size_t numBlocks = stream->bits.numBits / 8 / BLOCK_SIZE;
+    if(gif->sink == NULL || numBlocks == 0) {
+        return;
+    }
+
+    const size_t flushed = numBlocks * BLOCK_SIZE;
+    gif->sinkFailed |= !writeSubBlocks(gif->sink, gif->sinkData, stream->bits.data, flushed, 0);
+
+    //move the unfinished block (and the partly written byte) to the front
+    const size_t rest = (stream->bits.numBits + 7) / 8 - flushed;
+    memmove(stream->bits.data, stream->bits.data + flushed, rest);
+    memset(stream->bits.data + rest, 0, stream->bits.size - rest);
+    stream->bits.numBits -= 8 * (uint64_t) flushed;
+}
+
+void GIF_BeginFrame(Gif *gif, unsigned short x, unsigned short y,
+                    unsigned short width, unsigned short height,
+                    const unsigned short delayTime) {
+    if(gif->stream != NULL) {
+        GIF_EndFrame(gif);
+    }
+    finishQueue(gif);
+    flushPending(gif);
+    if(gif->budget != NULL) {
+        gif->budget->framesSeen++;
+    }
+
+    clipRect(gif, &x, &y, &width, &height);
+
+    StreamFrame *stream = malloc(sizeof(StreamFrame));
+    imageInit(gif, &stream->img, x, y, width, height, delayTime);
+    //the pixels are not known yet, so the code size covers the whole table
+    stream->img.LZWMinCodeSize = (gif->flags & 0x7) + 1 > 2 ? (gif->flags & 0x7) + 1 : 2;
+    stream->img.imageData = NULL;
+    stream->img.dataSize = 0;
+    stream->rowsLeft = height;
+
+    LZW_EncoderInit(&stream->enc, (1 << stream->img.LZWMinCodeSize) - 1);
+    stream->enc.clearWhenFull = gif->clearStrategy != GIF_CLEAR_NEVER;
+    const Lossy lossy = imageLossy(gif, &stream->img);
+    LZW_EncoderSetLossy(&stream->enc, lossy.table, lossy.exact);
+    stream->bits.data = NULL;
+    stream->bits.size = stream->bits.numBits = 0;
+    stream->nextCode = 0;
+    stream->codeSize = stream->img.LZWMinCodeSize + 1;
+    putCode(&stream->bits, 1 << stream->img.LZWMinCodeSize, stream->codeSize);
+
+    if(gif->sink != NULL) {
+        startSink(gif);
+        gif->sinkFailed |= gif->sink(&stream->img, offsetof(Image, imageData), gif->sinkData) !=
+                offsetof(Image, imageData);
+    }
+
+    gif->stream = stream;
+}
+
+void GIF_AddRows(Gif *gif, const unsigned char *rows, const size_t stride,
+                 const size_t numRows) {
+    StreamFrame *stream = gif->stream;
+    if(stream == NULL) {
+        return;
+    }
+
+    size_t i;
+    for(i = 0; i < numRows && stream->rowsLeft > 0; i++, stream->rowsLeft--) {
+        compressPixels(&stream->enc, (const char *) rows + i * stride, stream->img.width,
+                       stream->img.LZWMinCodeSize, &stream->bits,
+                       &stream->nextCode, &stream->codeSize);
+        flushStream(gif, stream);
+    }
+}
+
+void GIF_EndFrame(Gif *gif) {
+    StreamFrame *stream = gif->stream;
+    if(stream == NULL) {
+        return;
+    }
+
+    //rows that were never added are color 0
+    if(stream->rowsLeft > 0) {
+        unsigned char *zeros = calloc(stream->img.width > 0 ? stream->img.width : 1, 1);
+        while(stream->rowsLeft > 0) {
+            GIF_AddRows(gif, zeros, 0, 1);
+        }
+        free(zeros);
+    }
+
+    const char minCodeSize = stream->img.LZWMinCodeSize;
+    uint16_t code;
+    size_t written = LZW_CompressFinish(&stream->enc, &code, 1);
+    putCodes(&stream->bits, &code, written, minCodeSize, &stream->nextCode, &stream->codeSize);
+    putCode(&stream->bits, (1 << minCodeSize) + 1, stream->codeSize); //stop code
+
+    const size_t dataSize = (stream->bits.numBits + 7) / 8;
+    if(gif->sink != NULL) {
+        gif->sinkFailed |= !writeSubBlocks(gif->sink, gif->sinkData,
+                                           stream->bits.data, dataSize, 1);
+        free(stream->bits.data);
+        gif->numStored++;
+        if(gif->budget != NULL) {
+            stream->img.dataSize = dataSize;
+            gif->budget->usedBytes += imageBytes(&stream->img);
+        }
     }else{
-        gif->images = realloc(gif->images, sizeof(Image) * (gif->numFrames + 1));
+        stream->img.imageData = realloc(stream->bits.data, dataSize);
+        stream->img.dataSize = dataSize;
+        storeImage(gif, &stream->img);
+    }
+
+    free(stream);
+    gif->stream = NULL;
+}
+
+int GIF_Finish(Gif *gif) {
+    if(gif->sink == NULL) {
+        return 0;
     }
 
-    imageInit(gif, gif->images + gif->numFrames, delayTime);
-    gif->images[gif->numFrames].numBlocks = splitDataBlocks(data,
-            gif->width*gif->height,
-            gif->images[gif->numFrames].LZWMinCodeSize,
-            &(gif->images[gif->numFrames].imageData));
+    GIF_EndFrame(gif);
+    finishQueue(gif);
+    flushPending(gif);
+    startSink(gif);
+
+    const char trailer = TRAILER;
+    gif->sinkFailed |= gif->sink(&trailer, 1, gif->sinkData) != 1;
+    return !gif->sinkFailed && !overBudget(gif);
+}
 
-    gif->numFrames++;
+size_t GIF_NumFrames(const Gif *gif) {
+    return gif->numStored;
 }
 
-void GIF_Write(const Gif *gif, const char *fileName) {
+void GIF_Write(Gif *gif, const char *fileName) {
+    finishQueue(gif);
+    flushPending(gif);
     FILE *file = fopen(fileName, "wb");
 
     if(!file) {
@@ -304,34 +1380,12 @@ void GIF_Write(const Gif *gif, const char *fileName) {
         abort();
     }
 
-    fwrite(gif, sizeof(Gif) - sizeof(char*) - sizeof(Image*) - sizeof(size_t) - sizeof(short),
-            1, file); //write header
-    //color table size is 3*(2^(colorSizeFlag + 1)) (3 bytes per color)
-    fwrite(gif->colorTable, 3*(1 << ((gif->flags & 0xf) + 1)), 1, file); //write color table
-
-    if(gif->repeatTimes > 0) {
-        fwrite(REPEAT_HEADER, REPEAT_HEADER_SIZE, 1, file);
-        fputc(gif->repeatTimes >> 8, file);   //first byte of repeatTimes
-        fputc(gif->repeatTimes & 0xFF, file); //second byte of repeatTimes
-        fputc(0x00, file);                    //end header
-    }
+    writeHeader(gif, fileWrite, file);
 
     //write each image
-    int i;
+    size_t i;
     for(i = 0; i < gif->numFrames; i++) {
-        fwrite(gif->images+i, sizeof(Image) - sizeof(DataBlock*)
-                - sizeof(size_t), 1, file);
-
-        //write each data block
-        int j;
-        for(j = 0; j < gif->images[i].numBlocks; j++) {
-            fwrite(&gif->images[i].imageData[j].blockSize, 1, 1, file);
-
-            fwrite(gif->images[i].imageData[j].data,
-                    gif->images[i].imageData[j].blockSize, 1, file);
-        }
-
-        fputc(0x00, file); //block separator
+        writeImage(gif->images + i, fileWrite, file);
     }
 
     fputc(TRAILER, file); //write trailer
@@ -340,7 +1394,15 @@ void GIF_Write(const Gif *gif, const char *fileName) {
 }
 
 void GIF_Free(Gif *gif) {
-    int i;
+    finishQueue(gif);
+    flushPending(gif);
+    freeBudget(gif);
+    if(gif->stream != NULL) {
+        free(gif->stream->bits.data);
+        free(gif->stream);
+    }
+
+    size_t i;
     for(i = 0; i < gif->numFrames; i++) {
         freeImage(gif->images + i);
     }
@@ -348,5 +1410,10 @@ void GIF_Free(Gif *gif) {
     free(gif->images);
     gif->images = NULL;
 
+    if(gif->pool != NULL) {
+        pool_free(gif->pool);
+    }
+
+    free(gif->lossyTable);
     free(gif);
 }
@@ -0,0 +1,785 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include "Gif.h"
+
+static const unsigned char INTRODUCER = 0x21; //extension introducer
+static const unsigned char GCE_LABEL = 0xF9;  //Graphic Control Extension label
+static const unsigned char APP_LABEL = 0xFF;  //Application Extension label
+static const unsigned char SEPARATOR = 0x2C;  //image block separator
+static const unsigned char TRAILER = 0x3B;    //gif trailer
+
+//largest number of codes an LZW stream can define (12 bit codes)
+#define MAX_CODES 4096
+
+struct GifDecoder_priv {
+    const unsigned char *data;  //the whole file, owned by the caller
+    size_t size;
+    size_t pos;                 //read position in data
+    size_t firstFrame;          //position of the first block after the header
+
+    unsigned short width;       //canvas size
+    unsigned short height;
+    int repeat;                 //loop count, -1 for no looping extension
+
+    uint32_t globalPalette[256]; //RGBA colors, in canvas byte order
+    uint32_t palette[256];       //colors for the frame being decoded
+
+    GIF_FrameInfo prev;         //last frame drawn, its disposal is pending
+    int havePrev;
+    unsigned char *backup;      //canvas area saved for GIF_DISPOSE_PREVIOUS
+
+    unsigned char *row;         //color indices of one row of the frame
+    size_t rowLen;
+
+    //LZW string table, each code is its prefix code plus one suffix byte
+    uint16_t prefix[MAX_CODES];
+    uint8_t suffix[MAX_CODES];
+    uint8_t stack[MAX_CODES + 1];
+};
+
+/**
+ * Receives each row of a frame as it is decoded
+ *
+ * @param dec decoder with the row's color indices in dec->row
+ * @param target where the row goes
+ * @param frame the frame being decoded
+ * @param y row within the frame
+ */
+typedef void (*RowFunc)(const GifDecoder *dec, void *target, const GIF_FrameInfo *frame, size_t y);
+
+/**
+ * Box filter sums for a thumbnail, every canvas pixel adds to the one
+ * thumbnail pixel it falls in
+ */
+typedef struct {
+    uint64_t *sums;          //R, G, B and the number of opaque pixels added
+    unsigned short *column;  //thumbnail column of each canvas column
+    unsigned short width;
+    unsigned short height;
+} Thumbnail;
+
+static unsigned short readShort(const unsigned char *data) {
+    return data[0] | (data[1] << 8);
+}
+
+/**
+ * Reads a color table into RGBA colors, entries past the end of the table are
+ * opaque black
+ *
+ * @param dec decoder to read from, starting at dec->pos
+ * @param palette array of 256 colors to fill
+ * @param flags the flags byte that described the table
+ * @return 1 on success, 0 if the table runs off the end of the data
+ */
+static int readPalette(GifDecoder *dec, uint32_t *palette, const unsigned char flags) {
+    size_t numColors = 1 << ((flags & 0x7) + 1);
+    if(dec->pos + 3*numColors > dec->size) {
+        return 0;
+    }
+
+    size_t i;
+    for(i = 0; i < 256; i++) {
+        unsigned char rgba[4] = {0x00, 0x00, 0x00, 0xFF};
+        if(i < numColors) {
+            memcpy(rgba, dec->data + dec->pos + 3*i, 3);
+        }
+        memcpy(palette + i, rgba, 4);
+    }
+
+    dec->pos += 3*numColors;
+    return 1;
+}
+
+/**
+ * Skips over a sequence of data sub-blocks and its terminator
+ *
+ * @return 1 on success, 0 if the blocks run off the end of the data
+ */
+static int skipSubBlocks(GifDecoder *dec) {
+    while(dec->pos < dec->size) {
+        unsigned char blockSize = dec->data[dec->pos++];
+        if(blockSize == 0) {
+            return 1;
+        }
+        dec->pos += blockSize;
+    }
+
+    return 0;
+}
+
+/**
+ * Finds the loop count in the extensions before the first image
+ *
+ * @param dec decoder positioned after the global color table, the position is
+ * restored before returning
+ * @return the loop count from a NETSCAPE2.0 extension or -1 if there is none
+ */
+static int readRepeat(GifDecoder *dec) {
+    const size_t start = dec->pos;
+    int repeat = -1;
+
+    while(dec->pos + 2 <= dec->size && dec->data[dec->pos] == INTRODUCER) {
+        const unsigned char *ext = dec->data + dec->pos;
+        dec->pos += 2;
+
+        if(ext[1] == APP_LABEL && dec->pos + 16 <= dec->size &&
+                memcmp(ext + 2, "\x0BNETSCAPE2.0\x03\x01", 14) == 0) {
+            repeat = readShort(ext + 16);
+            break;
+        }
+
+        if(!skipSubBlocks(dec)) {
+            break;
+        }
+    }
+
+    dec->pos = start;
+    return repeat;
+}
+
+/**
+ * Converts color indices to RGBA and stores them on the canvas
+ *
+ * Pixels with the transparent index leave the canvas unchanged.
+ *
+ * @param palette RGBA colors to look the indices up in
+ * @param indices color indices to convert
+ * @param dst canvas position to write the first pixel at
+ * @param n number of pixels
+ * @param transparent the transparent index or -1 for none
+ */
+static void expandRow(const uint32_t *palette, const unsigned char *indices,
+                      unsigned char *dst, size_t n, const int transparent) {
+    size_t i = 0;
+#ifdef __AVX2__
+    const __m256i transparentIndex = _mm256_set1_epi32(transparent);
+    for(; i + 8 <= n; i += 8) {
+        __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (indices + i)));
+        __m256i pixels = _mm256_i32gather_epi32((const int *) palette, idx, 4);
+        if(transparent >= 0) {
+            __m256i keep = _mm256_cmpeq_epi32(idx, transparentIndex);
+            __m256i old = _mm256_loadu_si256((const __m256i *) (dst + 4*i));
+            pixels = _mm256_blendv_epi8(pixels, old, keep);
+        }
+        _mm256_storeu_si256((__m256i *) (dst + 4*i), pixels);
+    }
+#endif
+
+    if(transparent < 0) {
+        for(; i < n; i++) {
+            memcpy(dst + 4*i, palette + indices[i], 4);
+        }
+    }else{
+        for(; i < n; i++) {
+            if(indices[i] != transparent) {
+                memcpy(dst + 4*i, palette + indices[i], 4);
+            }
+        }
+    }
+}
+
+/**
+ * Draws one decoded row of the frame on the canvas, clipped to the canvas
+ *
+ * @param y row within the frame
+ */
+static void drawRow(const GifDecoder *dec, void *target,
+                    const GIF_FrameInfo *frame, size_t y) {
+    unsigned char *canvas = target;
+    size_t canvasY = frame->y + y;
+    if(canvasY >= dec->height || frame->x >= dec->width) {
+        return;
+    }
+
+    size_t n = frame->width;
+    if(frame->x + n > dec->width) {
+        n = dec->width - frame->x;
+    }
+
+    expandRow(dec->palette, dec->row,
+              canvas + 4*(canvasY*dec->width + frame->x), n,
+              frame->transparentIndex);
+}
+
+/**
+ * Copies the part of a frame's rectangle that is on the canvas between the
+ * canvas and another canvas sized buffer
+ */
+static void copyRect(const GifDecoder *dec, unsigned char *dst,
+                     const unsigned char *src, const GIF_FrameInfo *frame) {
+    if(frame->x >= dec->width || frame->y >= dec->height) {
+        return;
+    }
+
+    size_t width = frame->width;
+    size_t height = frame->height;
+    if(frame->x + width > dec->width) {
+        width = dec->width - frame->x;
+    }
+    if(frame->y + height > dec->height) {
+        height = dec->height - frame->y;
+    }
+
+    size_t y;
+    for(y = frame->y; y < frame->y + height; y++) {
+        size_t offset = 4*(y*dec->width + frame->x);
+        memcpy(dst + offset, src + offset, 4*width);
+    }
+}
+
+/**
+ * Applies the disposal method of the previously drawn frame
+ */
+static void disposePrevious(GifDecoder *dec, unsigned char *canvas) {
+    if(!dec->havePrev) {
+        return;
+    }
+
+    const GIF_FrameInfo *prev = &dec->prev;
+    if(prev->disposal == GIF_DISPOSE_BACKGROUND && prev->x < dec->width) {
+        size_t width = prev->width;
+        if(prev->x + width > dec->width) {
+            width = dec->width - prev->x;
+        }
+
+        size_t y;
+        for(y = prev->y; y < (size_t) prev->y + prev->height && y < dec->height; y++) {
+            memset(canvas + 4*(y*dec->width + prev->x), 0, 4*width);
+        }
+    }else if(prev->disposal == GIF_DISPOSE_PREVIOUS && dec->backup != NULL) {
+        copyRect(dec, canvas, dec->backup, prev);
+    }
+
+    dec->havePrev = 0;
+}
+
+/**
+ * Adds one decoded row of the frame to a thumbnail's sums, clipped to the
+ * canvas. Transparent pixels show the empty canvas, so they add nothing.
+ *
+ * @param y row within the frame
+ */
+static void shrinkRow(const GifDecoder *dec, void *target,
+                      const GIF_FrameInfo *frame, size_t y) {
+    const Thumbnail *thumb = target;
+    size_t canvasY = frame->y + y;
+    if(canvasY >= dec->height || frame->x >= dec->width) {
+        return;
+    }
+
+    size_t n = frame->width;
+    if(frame->x + n > dec->width) {
+        n = dec->width - frame->x;
+    }
+
+    uint64_t *sums = thumb->sums + 4 * (canvasY * thumb->height / dec->height) * thumb->width;
+    const unsigned short *column = thumb->column + frame->x;
+    size_t i;
+    for(i = 0; i < n; i++) {
+        if(dec->row[i] == frame->transparentIndex) {
+            continue;
+        }
+
+        const unsigned char *color = (const unsigned char *) (dec->palette + dec->row[i]);
+        uint64_t *sum = sums + 4*column[i];
+        sum[0] += color[0];
+        sum[1] += color[1];
+        sum[2] += color[2];
+        sum[3]++;
+    }
+}
+
+/**
+ * Adds a whole RGBA canvas to a thumbnail's sums
+ */
+static void shrinkCanvas(const GifDecoder *dec, Thumbnail *thumb, const unsigned char *canvas) {
+    size_t x, y;
+    for(y = 0; y < dec->height; y++) {
+        uint64_t *sums = thumb->sums + 4 * (y * thumb->height / dec->height) * thumb->width;
+        for(x = 0; x < dec->width; x++, canvas += 4) {
+            if(canvas[3] == 0) {
+                continue;
+            }
+
+            uint64_t *sum = sums + 4*thumb->column[x];
+            sum[0] += canvas[0];
+            sum[1] += canvas[1];
+            sum[2] += canvas[2];
+            sum[3]++;
+        }
+    }
+}
+
+/**
+ * Averages a thumbnail's sums into RGBA pixels
+ *
+ * The color is the average of the opaque pixels and the alpha is the part of
+ * the box they cover, so transparent pixels don't darken the edges.
+ */
+static void finishThumbnail(const GifDecoder *dec, const Thumbnail *thumb, unsigned char *pixels) {
+    size_t x, y;
+    for(y = 0; y < thumb->height; y++) {
+        //number of canvas rows and columns in this pixel's box
+        const uint64_t rows = ((y + 1) * dec->height + thumb->height - 1) / thumb->height -
+                              (y * dec->height + thumb->height - 1) / thumb->height;
+        for(x = 0; x < thumb->width; x++, pixels += 4) {
+            const uint64_t columns = ((x + 1) * dec->width + thumb->width - 1) / thumb->width -
+                                     (x * dec->width + thumb->width - 1) / thumb->width;
+            const uint64_t area = rows * columns;
+            const uint64_t *sum = thumb->sums + 4*(y*thumb->width + x);
+            const uint64_t opaque = sum[3];
+
+            if(opaque == 0) {
+                memset(pixels, 0, 4);
+                continue;
+            }
+
+            pixels[0] = (sum[0] + opaque/2) / opaque;
+            pixels[1] = (sum[1] + opaque/2) / opaque;
+            pixels[2] = (sum[2] + opaque/2) / opaque;
+            pixels[3] = (255*opaque + area/2) / area;
+        }
+    }
+}
+
+/**
+ * Decodes the LZW compressed image data of a frame one row at a time
+ *
+ * @param dec decoder positioned at the LZW minimum code size byte
+ * @param emit called with each row as it is finished
+ * @param target passed to emit
+ * @param frame the frame being decoded
+ * @param interlaced 1 if the rows are stored in interlaced order
+ * @return 1 on success, 0 if the data is corrupt
+ */
+static int decodeImage(GifDecoder *dec, RowFunc emit, void *target,
+                       const GIF_FrameInfo *frame, const int interlaced) {
+    static const size_t PASS_START[4] = {0, 4, 2, 1};
+    static const size_t PASS_STEP[4] = {8, 8, 4, 2};
+
+    if(dec->pos >= dec->size) {
+        return 0;
+    }
+
+    const int minCodeSize = dec->data[dec->pos++];
+    if(minCodeSize < 1 || minCodeSize > 8) {
+        return 0;
+    }
+
+    if(frame->width > dec->rowLen) {
+        unsigned char *row = realloc(dec->row, frame->width);
+        if(row == NULL) {
+            return 0;
+        }
+        dec->row = row;
+        dec->rowLen = frame->width;
+    }
+
+    const uint16_t clearCode = 1 << minCodeSize;
+    const uint16_t stopCode = clearCode + 1;
+    uint16_t nextCode = clearCode + 2;
+    int codeSize = minCodeSize + 1;
+    int oldCode = -1;
+    uint8_t first = 0;
+
+    uint16_t i;
+    for(i = 0; i < clearCode; i++) {
+        dec->suffix[i] = i;
+    }
+
+    uint32_t bits = 0;
+    int numBits = 0;
+    size_t blockLeft = 0;
+    int finished = 0; //1 once the sub-block terminator has been read
+
+    size_t x = 0;
+    size_t y = interlaced ? PASS_START[0] : 0;
+    int pass = 0;
+    size_t rowsLeft = frame->width > 0 ? frame->height : 0;
+
+    while(1) {
+        while(numBits < codeSize) {
+            if(blockLeft == 0) {
+                if(dec->pos >= dec->size) {
+                    return 0;
+                }
+                blockLeft = dec->data[dec->pos++];
+                if(blockLeft == 0) {
+                    finished = 1;
+                    break;
+                }
+            }
+            if(dec->pos >= dec->size) {
+                return 0;
+            }
+
+            bits |= (uint32_t) dec->data[dec->pos++] << numBits;
+            numBits += 8;
+            blockLeft--;
+        }
+
+        if(finished) {
+            break; //the data ended without a stop code
+        }
+
+        uint16_t code = bits & ((1 << codeSize) - 1);
+        bits >>= codeSize;
+        numBits -= codeSize;
+
+        if(code == clearCode) {
+            nextCode = clearCode + 2;
+            codeSize = minCodeSize + 1;
+            oldCode = -1;
+            continue;
+        }else if(code == stopCode) {
+            break;
+        }
+
+        //walk the string for this code backwards onto the stack
+        size_t stackSize = 0;
+        const uint16_t inCode = code;
+        if(oldCode == -1) {
+            if(code >= clearCode) {
+                return 0;
+            }
+        }else if(code == nextCode) {
+            dec->stack[stackSize++] = first;
+            code = oldCode;
+        }else if(code > nextCode) {
+            return 0;
+        }
+
+        while(code >= clearCode) {
+            dec->stack[stackSize++] = dec->suffix[code];
+            code = dec->prefix[code];
+        }
+        first = dec->suffix[code];
+        dec->stack[stackSize++] = first;
+
+        if(oldCode != -1 && nextCode < MAX_CODES) {
+            dec->prefix[nextCode] = oldCode;
+            dec->suffix[nextCode] = first;
+            nextCode++;
+            if(nextCode == (1 << codeSize) && codeSize < 12) {
+                codeSize++;
+            }
+        }
+        oldCode = inCode;
+
+        //output the string, drawing each row as it fills
+        while(stackSize > 0 && rowsLeft > 0) {
+            dec->row[x++] = dec->stack[--stackSize];
+            if(x == frame->width) {
+                emit(dec, target, frame, y);
+                x = 0;
+                rowsLeft--;
+
+                if(interlaced) {
+                    y += PASS_STEP[pass];
+                    while(y >= frame->height && pass < 3) {
+                        pass++;
+                        y = PASS_START[pass];
+                    }
+                }else{
+                    y++;
+                }
+            }
+        }
+    }
+
+    //encoders may pad the last sub-block after the stop code
+    dec->pos += blockLeft;
+    return finished || skipSubBlocks(dec);
+}
+
+GifDecoder *GIF_DecoderOpen(const unsigned char *data, const size_t size) {
+    if(size < 13 || memcmp(data, "GIF", 3) != 0 ||
+            (memcmp(data + 3, "89a", 3) != 0 && memcmp(data + 3, "87a", 3) != 0)) {
+        return NULL;
+    }
+
+    GifDecoder *dec = malloc(sizeof(GifDecoder));
+    if(dec == NULL) {
+        return NULL;
+    }
+
+    dec->data = data;
+    dec->size = size;
+    dec->width = readShort(data + 6);
+    dec->height = readShort(data + 8);
+    dec->pos = 13;
+
+    const unsigned char flags = data[10];
+    memset(dec->globalPalette, 0, sizeof(dec->globalPalette));
+    if((flags & 0x80) && !readPalette(dec, dec->globalPalette, flags)) {
+        free(dec);
+        return NULL;
+    }
+
+    dec->firstFrame = dec->pos;
+    dec->repeat = readRepeat(dec);
+    dec->havePrev = 0;
+    dec->backup = NULL;
+    dec->rowLen = dec->width > 0 ? dec->width : 1;
+    dec->row = malloc(dec->rowLen);
+    if(dec->row == NULL) {
+        free(dec);
+        return NULL;
+    }
+
+    return dec;
+}
+
+unsigned short GIF_DecoderWidth(const GifDecoder *dec) {
+    return dec->width;
+}
+
+unsigned short GIF_DecoderHeight(const GifDecoder *dec) {
+    return dec->height;
+}
+
+int GIF_DecoderRepeat(const GifDecoder *dec) {
+    return dec->repeat;
+}
+
+/**
+ * Reads the blocks up to the next frame's image data: its extensions, image
+ * descriptor and color table (into dec->palette)
+ *
+ * @param dec decoder positioned at the start of a block
+ * @param frame receives the frame's information
+ * @param flags receives the flags byte of the image descriptor
+ * @return 1 if a frame was read, 0 at the end of the file, -1 if the data is
+ * corrupt
+ */
+static int readFrame(GifDecoder *dec, GIF_FrameInfo *frame, unsigned char *flags) {
+    frame->delayTime = 0;
+    frame->disposal = GIF_DISPOSE_NONE;
+    frame->transparentIndex = -1;
+
+    while(dec->pos < dec->size) {
+        const unsigned char block = dec->data[dec->pos++];
+
+        if(block == TRAILER) {
+            dec->pos--; //stay on the trailer so later calls also return 0
+            return 0;
+        }else if(block == INTRODUCER) {
+            if(dec->pos >= dec->size) {
+                return -1;
+            }
+
+            const unsigned char label = dec->data[dec->pos++];
+            if(label == GCE_LABEL && dec->pos + 5 <= dec->size && dec->data[dec->pos] >= 4) {
+                const unsigned char *gce = dec->data + dec->pos + 1;
+                const int disposal = (gce[0] >> 2) & 0x7;
+                frame->disposal = disposal <= GIF_DISPOSE_PREVIOUS ?
+                        (GIF_Disposal) disposal : GIF_DISPOSE_NONE;
+                frame->delayTime = readShort(gce + 1);
+                frame->transparentIndex = (gce[0] & 0x1) ? gce[3] : -1;
+            }
+
+            if(!skipSubBlocks(dec)) {
+                return -1;
+            }
+        }else if(block == SEPARATOR) {
+            if(dec->pos + 9 > dec->size) {
+                return -1;
+            }
+
+            const unsigned char *desc = dec->data + dec->pos;
+            frame->x = readShort(desc);
+            frame->y = readShort(desc + 2);
+            frame->width = readShort(desc + 4);
+            frame->height = readShort(desc + 6);
+            *flags = desc[8];
+            dec->pos += 9;
+
+            if(*flags & 0x80) {
+                if(!readPalette(dec, dec->palette, *flags)) {
+                    return -1;
+                }
+            }else{
+                memcpy(dec->palette, dec->globalPalette, sizeof(dec->palette));
+            }
+
+            return 1;
+        }else{
+            return -1;
+        }
+    }
+
+    return 0; //missing trailer, treat the end of the data as the end
+}
+
+int GIF_DecodeFrame(GifDecoder *dec, unsigned char *canvas, GIF_FrameInfo *info) {
+    if(dec->pos == dec->firstFrame) {
+        memset(canvas, 0, 4 * (size_t) dec->width * dec->height);
+        dec->havePrev = 0;
+    }
+
+    GIF_FrameInfo frame;
+    unsigned char flags;
+    const int found = readFrame(dec, &frame, &flags);
+    if(found != 1) {
+        return found;
+    }
+
+    disposePrevious(dec, canvas);
+
+    if(frame.disposal == GIF_DISPOSE_PREVIOUS) {
+        if(dec->backup == NULL) {
+            dec->backup = malloc(4 * (size_t) dec->width * dec->height);
+            if(dec->backup == NULL) {
+                return -1;
+            }
+        }
+        copyRect(dec, dec->backup, canvas, &frame);
+    }
+
+    if(!decodeImage(dec, drawRow, canvas, &frame, flags & 0x40)) {
+        return -1;
+    }
+
+    dec->prev = frame;
+    dec->havePrev = 1;
+    if(info != NULL) {
+        *info = frame;
+    }
+
+    return 1;
+}
+
+/**
+ * Finds the last frame up to frameIndex that the frames after it can be drawn
+ * from without the ones before it: one that covers the whole canvas with no
+ * transparency and is not restored by GIF_DISPOSE_PREVIOUS afterwards
+ *
+ * @param dec decoder positioned at the first frame, left after frameIndex
+ * @param frameIndex frame that will be shown
+ * @param start receives the position of the frame to start decoding at
+ * @param startIndex receives the index of that frame
+ * @return 1 if frameIndex exists, 0 if there are fewer frames, -1 if the data
+ * is corrupt
+ */
+static int findStartFrame(GifDecoder *dec, const size_t frameIndex,
+                          size_t *start, size_t *startIndex) {
+    *start = dec->firstFrame;
+    *startIndex = 0;
+
+    size_t i;
+    for(i = 0; i <= frameIndex; i++) {
+        const size_t pos = dec->pos;
+        GIF_FrameInfo frame;
+        unsigned char flags;
+        const int found = readFrame(dec, &frame, &flags);
+        if(found != 1) {
+            return found;
+        }
+
+        if(frame.x == 0 && frame.y == 0 && frame.width >= dec->width &&
+                frame.height >= dec->height && frame.transparentIndex < 0 &&
+                (i == frameIndex || frame.disposal != GIF_DISPOSE_PREVIOUS)) {
+            *start = pos;
+            *startIndex = i;
+        }
+
+        //skip the minimum code size and the image data without decoding it
+        dec->pos++;
+        if(!skipSubBlocks(dec)) {
+            return -1;
+        }
+    }
+
+    return 1;
+}
+
+int GIF_DecodeThumbnail(GifDecoder *dec, const size_t frameIndex, unsigned char *pixels,
+                        const unsigned short width, const unsigned short height,
+                        GIF_FrameInfo *info) {
+    if(width < 1 || height < 1 || width > dec->width || height > dec->height) {
+        return -1;
+    }
+
+    GIF_DecoderRewind(dec);
+    size_t start, startIndex;
+    int result = findStartFrame(dec, frameIndex, &start, &startIndex);
+    if(result != 1) {
+        GIF_DecoderRewind(dec);
+        return result;
+    }
+
+    Thumbnail thumb;
+    thumb.width = width;
+    thumb.height = height;
+    thumb.sums = calloc(4 * (size_t) width * height, sizeof(uint64_t));
+    thumb.column = malloc(sizeof(unsigned short) * dec->width);
+    if(thumb.sums == NULL || thumb.column == NULL) {
+        free(thumb.sums);
+        free(thumb.column);
+        GIF_DecoderRewind(dec);
+        return -1;
+    }
+
+    size_t x;
+    for(x = 0; x < dec->width; x++) {
+        thumb.column[x] = x * width / dec->width;
+    }
+
+    dec->pos = start;
+    GIF_FrameInfo frame;
+    if(startIndex == frameIndex) {
+        //nothing before the frame shows through, its rows go straight into the
+        //thumbnail
+        unsigned char flags;
+        result = readFrame(dec, &frame, &flags);
+        if(result == 1 && !decodeImage(dec, shrinkRow, &thumb, &frame, flags & 0x40)) {
+            result = -1;
+        }
+    }else{
+        //the frames from the start frame on are drawn over each other, which
+        //needs the whole canvas
+        unsigned char *canvas = malloc(4 * (size_t) dec->width * dec->height);
+        if(canvas == NULL) {
+            result = -1;
+        }else{
+            memset(canvas, 0, 4 * (size_t) dec->width * dec->height);
+            dec->havePrev = 0;
+
+            size_t i;
+            for(i = startIndex; i <= frameIndex && result == 1; i++) {
+                result = GIF_DecodeFrame(dec, canvas, &frame);
+            }
+            if(result == 1) {
+                shrinkCanvas(dec, &thumb, canvas);
+            }
+            free(canvas);
+        }
+    }
+
+    if(result == 1) {
+        finishThumbnail(dec, &thumb, pixels);
+        if(info != NULL) {
+            *info = frame;
+        }
+    }
+
+    free(thumb.sums);
+    free(thumb.column);
+    GIF_DecoderRewind(dec);
+    return result;
+}
+
+void GIF_DecoderRewind(GifDecoder *dec) {
+    dec->pos = dec->firstFrame;
+    dec->havePrev = 0;
+}
+
+void GIF_DecoderFree(GifDecoder *dec) {
+    free(dec->row);
+    free(dec->backup);
+    free(dec);
+}
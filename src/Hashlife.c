@@ -0,0 +1,551 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "Hashlife.h"
+
+//arbitrary initial values, both grow with the pattern
+static const size_t INITIAL_BUCKETS = 1 << 16;
+static const size_t INITIAL_MAX_NODES = 1 << 20;
+
+static size_t hashNode(const LifeNode *nw, const LifeNode *ne,
+                       const LifeNode *sw, const LifeNode *se) {
+    uint64_t hash = (uintptr_t) nw;
+    hash = hash * 0x9E3779B97F4A7C15ULL + (uintptr_t) ne;
+    hash = hash * 0x9E3779B97F4A7C15ULL + (uintptr_t) sw;
+    hash = hash * 0x9E3779B97F4A7C15ULL + (uintptr_t) se;
+    return hash ^ (hash >> 29);
+}
+
+/**
+ * Doubles the number of hash buckets
+ */
+static void growTable(Life *life) {
+    size_t numBuckets = 2 * life->numBuckets;
+    LifeNode **buckets = calloc(numBuckets, sizeof(LifeNode *));
+
+    size_t i;
+    for(i = 0; i < life->numBuckets; i++) {
+        LifeNode *node = life->buckets[i];
+        while(node != NULL) {
+            LifeNode *next = node->next;
+            size_t bucket = hashNode(node->nw, node->ne, node->sw, node->se) & (numBuckets - 1);
+            node->next = buckets[bucket];
+            buckets[bucket] = node;
+            node = next;
+        }
+    }
+
+    free(life->buckets);
+    life->buckets = buckets;
+    life->numBuckets = numBuckets;
+}
+
+/**
+ * Finds or creates the node with the given quadrants
+ *
+ * @return the canonical node one level above the quadrants
+ */
+static LifeNode *join(Life *life, LifeNode *nw, LifeNode *ne, LifeNode *sw, LifeNode *se) {
+    size_t bucket = hashNode(nw, ne, sw, se) & (life->numBuckets - 1);
+
+    LifeNode *node;
+    for(node = life->buckets[bucket]; node != NULL; node = node->next) {
+        if(node->nw == nw && node->ne == ne && node->sw == sw && node->se == se) {
+            return node;
+        }
+    }
+
+    node = malloc(sizeof(LifeNode));
+    node->nw = nw;
+    node->ne = ne;
+    node->sw = sw;
+    node->se = se;
+    node->result = NULL;
+    node->population = nw->population + ne->population + sw->population + se->population;
+    node->level = nw->level + 1;
+    node->marked = 0;
+    node->next = life->buckets[bucket];
+    life->buckets[bucket] = node;
+
+    life->numNodes++;
+    if(life->numNodes > life->numBuckets) {
+        growTable(life);
+    }
+
+    return node;
+}
+
+static LifeNode *emptyNode(Life *life, const int level) {
+    if(level == 0) {
+        return &life->dead;
+    }
+
+    if(life->empty[level] == NULL) {
+        LifeNode *quadrant = emptyNode(life, level - 1);
+        life->empty[level] = join(life, quadrant, quadrant, quadrant, quadrant);
+    }
+
+    return life->empty[level];
+}
+
+/**
+ * @return the node made of the inner quadrants of a node's quadrants
+ */
+static LifeNode *center(Life *life, const LifeNode *node) {
+    return join(life, node->nw->se, node->ne->sw, node->sw->ne, node->se->nw);
+}
+
+/**
+ * @return the node centered on the border between two side by side nodes
+ */
+static LifeNode *centerHorizontal(Life *life, const LifeNode *w, const LifeNode *e) {
+    return join(life, w->ne, e->nw, w->se, e->sw);
+}
+
+/**
+ * @return the node centered on the border between two stacked nodes
+ */
+static LifeNode *centerVertical(Life *life, const LifeNode *n, const LifeNode *s) {
+    return join(life, n->sw, n->se, s->nw, s->ne);
+}
+
+/**
+ * Like center, but one level lower: the inner quadrants of the quadrants'
+ * inner quadrants
+ */
+static LifeNode *subCenter(Life *life, const LifeNode *node) {
+    return join(life, node->nw->se->se, node->ne->sw->sw, node->sw->ne->ne, node->se->nw->nw);
+}
+
+/**
+ * Computes one generation of the center 2x2 cells of a 4x4 node
+ */
+static LifeNode *baseCase(Life *life, const LifeNode *node) {
+    //bit x + 4*y is the cell at x, y
+    unsigned int cells = 0;
+    const LifeNode *quadrants[4] = {node->nw, node->ne, node->sw, node->se};
+    int i;
+    for(i = 0; i < 4; i++) {
+        int x = 2 * (i % 2);
+        int y = 2 * (i / 2);
+        cells |= quadrants[i]->nw->population << (x + 4*y);
+        cells |= quadrants[i]->ne->population << (x + 1 + 4*y);
+        cells |= quadrants[i]->sw->population << (x + 4*(y + 1));
+        cells |= quadrants[i]->se->population << (x + 1 + 4*(y + 1));
+    }
+
+    LifeNode *next[4];
+    for(i = 0; i < 4; i++) {
+        int x = 1 + i % 2;
+        int y = 1 + i / 2;
+        int neighbors = 0;
+        int dx, dy;
+        for(dy = -1; dy <= 1; dy++) {
+            for(dx = -1; dx <= 1; dx++) {
+                if(dx != 0 || dy != 0) {
+                    neighbors += (cells >> (x + dx + 4*(y + dy))) & 1;
+                }
+            }
+        }
+
+        int alive = (cells >> (x + 4*y)) & 1;
+        next[i] = (neighbors == 3 || (alive && neighbors == 2)) ? &life->alive : &life->dead;
+    }
+
+    return join(life, next[0], next[1], next[2], next[3]);
+}
+
+/**
+ * Computes the center of a node 2^min(level - 2, stepLog2) generations later
+ *
+ * The result is memoized in the node.
+ *
+ * @param life universe the node belongs to
+ * @param node node of level 2 or more
+ * @return the center of the node, one level lower
+ */
+static LifeNode *successor(Life *life, LifeNode *node) {
+    if(node->result != NULL) {
+        return node->result;
+    }
+
+    LifeNode *result;
+    if(node->population == 0) {
+        result = emptyNode(life, node->level - 1);
+    }else if(node->level == 2) {
+        result = baseCase(life, node);
+    }else{
+        //9 overlapping sub-nodes, advanced as far as the step allows
+        LifeNode *r00 = successor(life, node->nw);
+        LifeNode *r01 = successor(life, centerHorizontal(life, node->nw, node->ne));
+        LifeNode *r02 = successor(life, node->ne);
+        LifeNode *r10 = successor(life, centerVertical(life, node->nw, node->sw));
+        LifeNode *r11 = successor(life, center(life, node));
+        LifeNode *r12 = successor(life, centerVertical(life, node->ne, node->se));
+        LifeNode *r20 = successor(life, node->sw);
+        LifeNode *r21 = successor(life, centerHorizontal(life, node->sw, node->se));
+        LifeNode *r22 = successor(life, node->se);
+
+        LifeNode *nw = join(life, r00, r01, r10, r11);
+        LifeNode *ne = join(life, r01, r02, r11, r12);
+        LifeNode *sw = join(life, r10, r11, r20, r21);
+        LifeNode *se = join(life, r11, r12, r21, r22);
+
+        if(life->stepLog2 >= node->level - 2) {
+            //full speed, advance again
+            result = join(life, successor(life, nw), successor(life, ne),
+                                successor(life, sw), successor(life, se));
+        }else{
+            result = join(life, center(life, nw), center(life, ne),
+                                center(life, sw), center(life, se));
+        }
+    }
+
+    node->result = result;
+    return result;
+}
+
+/**
+ * Doubles the size of the universe keeping the contents centered
+ */
+static void expand(Life *life) {
+    LifeNode *root = life->root;
+    LifeNode *border = emptyNode(life, root->level - 1);
+
+    life->root = join(life,
+            join(life, border, border, border, root->nw),
+            join(life, border, border, root->ne, border),
+            join(life, border, root->sw, border, border),
+            join(life, root->se, border, border, border));
+
+    int64_t offset = (int64_t) 1 << (root->level - 1);
+    life->x -= offset;
+    life->y -= offset;
+}
+
+static void mark(LifeNode *node) {
+    if(node == NULL || node->marked || node->level == 0) {
+        return;
+    }
+
+    node->marked = 1;
+    mark(node->nw);
+    mark(node->ne);
+    mark(node->sw);
+    mark(node->se);
+}
+
+/**
+ * Frees every node not used by the root and forgets all memoized results
+ */
+static void collect(Life *life) {
+    mark(life->root);
+    int i;
+    for(i = 0; i < 64; i++) {
+        mark(life->empty[i]);
+    }
+
+    size_t bucket;
+    for(bucket = 0; bucket < life->numBuckets; bucket++) {
+        LifeNode **link = &life->buckets[bucket];
+        while(*link != NULL) {
+            LifeNode *node = *link;
+            if(node->marked) {
+                node->marked = 0;
+                node->result = NULL;
+                link = &node->next;
+            }else{
+                *link = node->next;
+                free(node);
+                life->numNodes--;
+            }
+        }
+    }
+
+    if(life->maxNodes < 2 * life->numNodes) {
+        life->maxNodes = 2 * life->numNodes;
+    }
+}
+
+void life_init(Life *life) {
+    memset(life, 0, sizeof(Life));
+
+    life->dead.level = life->alive.level = 0;
+    life->dead.population = 0;
+    life->alive.population = 1;
+
+    life->numBuckets = INITIAL_BUCKETS;
+    life->buckets = calloc(life->numBuckets, sizeof(LifeNode *));
+    life->maxNodes = INITIAL_MAX_NODES;
+
+    life->root = emptyNode(life, 3);
+    life->x = life->y = -4;
+}
+
+void life_free(Life *life) {
+    size_t bucket;
+    for(bucket = 0; bucket < life->numBuckets; bucket++) {
+        LifeNode *node = life->buckets[bucket];
+        while(node != NULL) {
+            LifeNode *next = node->next;
+            free(node);
+            node = next;
+        }
+    }
+
+    free(life->buckets);
+    life->buckets = NULL;
+}
+
+static LifeNode *setNode(Life *life, LifeNode *node, int64_t x, int64_t y, const int alive) {
+    if(node->level == 0) {
+        return alive ? &life->alive : &life->dead;
+    }
+
+    int64_t half = (int64_t) 1 << (node->level - 1);
+    LifeNode *nw = node->nw, *ne = node->ne, *sw = node->sw, *se = node->se;
+    if(y < half) {
+        if(x < half) {
+            nw = setNode(life, nw, x, y, alive);
+        }else{
+            ne = setNode(life, ne, x - half, y, alive);
+        }
+    }else{
+        if(x < half) {
+            sw = setNode(life, sw, x, y - half, alive);
+        }else{
+            se = setNode(life, se, x - half, y - half, alive);
+        }
+    }
+
+    return join(life, nw, ne, sw, se);
+}
+
+void life_set(Life *life, int64_t x, int64_t y, const int alive) {
+    while(x < life->x || y < life->y ||
+            x - life->x >= ((int64_t) 1 << life->root->level) ||
+            y - life->y >= ((int64_t) 1 << life->root->level)) {
+        expand(life);
+    }
+
+    life->root = setNode(life, life->root, x - life->x, y - life->y, alive);
+}
+
+int life_get(const Life *life, int64_t x, int64_t y) {
+    const LifeNode *node = life->root;
+    x -= life->x;
+    y -= life->y;
+    if(x < 0 || y < 0 || x >= ((int64_t) 1 << node->level) || y >= ((int64_t) 1 << node->level)) {
+        return 0;
+    }
+
+    while(node->level > 0) {
+        int64_t half = (int64_t) 1 << (node->level - 1);
+        if(y < half) {
+            node = x < half ? node->nw : node->ne;
+        }else{
+            node = x < half ? node->sw : node->se;
+            y -= half;
+        }
+        if(x >= half) {
+            x -= half;
+        }
+    }
+
+    return node->population == 1;
+}
+
+int life_loadRLE(Life *life, const char *rle, int64_t x, int64_t y) {
+    //skip comments and the header line
+    while(*rle == '#' || *rle == 'x') {
+        rle = strchr(rle, '\n');
+        if(rle == NULL) {
+            return 0;
+        }
+        rle++;
+    }
+
+    int64_t col = 0, row = 0, count = 0;
+    for(; *rle != '\0' && *rle != '!'; rle++) {
+        if(isdigit((unsigned char) *rle)) {
+            count = 10*count + (*rle - '0');
+            continue;
+        }
+
+        if(count == 0) {
+            count = 1;
+        }
+
+        if(*rle == 'b') {
+            col += count;
+        }else if(*rle == 'o') {
+            for(; count > 0; count--, col++) {
+                life_set(life, x + col, y + row, 1);
+            }
+        }else if(*rle == '$') {
+            row += count;
+            col = 0;
+        }else if(!isspace((unsigned char) *rle)) {
+            return 0;
+        }
+
+        count = 0;
+    }
+
+    return *rle == '!';
+}
+
+void life_setStep(Life *life, const int stepLog2) {
+    if(stepLog2 == life->stepLog2) {
+        return;
+    }
+
+    //memoized results were computed for the old step size
+    size_t bucket;
+    for(bucket = 0; bucket < life->numBuckets; bucket++) {
+        LifeNode *node;
+        for(node = life->buckets[bucket]; node != NULL; node = node->next) {
+            node->result = NULL;
+        }
+    }
+
+    life->stepLog2 = stepLog2;
+}
+
+void life_step(Life *life) {
+    if(life->numNodes > life->maxNodes) {
+        collect(life);
+    }
+
+    //the pattern must be in the middle so nothing leaves the result
+    while(life->root->level < life->stepLog2 + 3 ||
+            subCenter(life, life->root)->population != life->root->population) {
+        expand(life);
+    }
+
+    int64_t offset = (int64_t) 1 << (life->root->level - 2);
+    life->root = successor(life, life->root);
+    life->x += offset;
+    life->y += offset;
+    life->generation += (uint64_t) 1 << life->stepLog2;
+}
+
+uint64_t life_population(const Life *life) {
+    return life->root->population;
+}
+
+typedef struct {
+    unsigned char *frame;
+    size_t width;
+    size_t height;
+    int64_t x;       //cell at the top-left pixel
+    int64_t y;
+    int zoom;
+    unsigned char alive;
+    size_t stride;   //bytes per row of a bitmap, 0 for one byte per pixel
+} View;
+
+/**
+ * @return the pixel coordinate a cell coordinate falls in (for negative zoom)
+ */
+static int64_t cellToPixel(int64_t cell, int64_t origin, int zoom) {
+    int64_t offset = cell - origin;
+    int64_t cellsPerPixel = (int64_t) 1 << -zoom;
+    //round down for cells left of or above the view
+    return offset >= 0 ? offset / cellsPerPixel : -((-offset + cellsPerPixel - 1) / cellsPerPixel);
+}
+
+static void fillPixels(const View *view, int64_t x0, int64_t y0, int64_t x1, int64_t y1) {
+    if(x0 < 0) x0 = 0;
+    if(y0 < 0) y0 = 0;
+    if(x1 > (int64_t) view->width) x1 = view->width;
+    if(y1 > (int64_t) view->height) y1 = view->height;
+
+    int64_t y;
+    if(view->stride == 0) {
+        for(y = y0; y < y1; y++) {
+            memset(view->frame + y*view->width + x0, view->alive, x1 - x0);
+        }
+        return;
+    }
+
+    //set the bits least significant first, whole bytes at a time in the middle
+    for(y = y0; y < y1; y++) {
+        unsigned char *row = view->frame + y*view->stride;
+        int64_t x = x0;
+        for(; x < x1 && (x & 7) != 0; x++) {
+            row[x >> 3] |= 1 << (x & 7);
+        }
+        if(x + 8 <= x1) {
+            memset(row + (x >> 3), 0xFF, (x1 - x) >> 3);
+            x += (x1 - x) & ~(int64_t) 7;
+        }
+        for(; x < x1; x++) {
+            row[x >> 3] |= 1 << (x & 7);
+        }
+    }
+}
+
+static void renderNode(const View *view, const LifeNode *node, int64_t x, int64_t y) {
+    if(node->population == 0) {
+        return;
+    }
+
+    //cull nodes outside of the view, in cell coordinates
+    int64_t size = (int64_t) 1 << node->level;
+    int64_t viewWidth, viewHeight;
+    if(view->zoom >= 0) {
+        viewWidth = (view->width + (1 << view->zoom) - 1) >> view->zoom;
+        viewHeight = (view->height + (1 << view->zoom) - 1) >> view->zoom;
+    }else{
+        viewWidth = (int64_t) view->width << -view->zoom;
+        viewHeight = (int64_t) view->height << -view->zoom;
+    }
+    if(x >= view->x + viewWidth || y >= view->y + viewHeight ||
+            x + size <= view->x || y + size <= view->y) {
+        return;
+    }
+
+    if(node->level == 0 && view->zoom >= 0) {
+        int64_t px = (x - view->x) << view->zoom;
+        int64_t py = (y - view->y) << view->zoom;
+        fillPixels(view, px, py, px + (1 << view->zoom), py + (1 << view->zoom));
+        return;
+    }
+
+    if(view->zoom < 0) {
+        int64_t px = cellToPixel(x, view->x, view->zoom);
+        int64_t py = cellToPixel(y, view->y, view->zoom);
+        if(px == cellToPixel(x + size - 1, view->x, view->zoom) &&
+                py == cellToPixel(y + size - 1, view->y, view->zoom)) {
+            //the whole node is in one pixel
+            fillPixels(view, px, py, px + 1, py + 1);
+            return;
+        }
+    }
+
+    int64_t half = size / 2;
+    renderNode(view, node->nw, x, y);
+    renderNode(view, node->ne, x + half, y);
+    renderNode(view, node->sw, x, y + half);
+    renderNode(view, node->se, x + half, y + half);
+}
+
+void life_render(const Life *life, unsigned char *frame,
+                 const size_t width, const size_t height,
+                 const int64_t x, const int64_t y, const int zoom,
+                 const unsigned char dead, const unsigned char alive) {
+    memset(frame, dead, width * height);
+
+    View view = {frame, width, height, x, y, zoom, alive, 0};
+    renderNode(&view, life->root, life->x, life->y);
+}
+
+void life_renderBitmap(const Life *life, unsigned char *bits, const size_t stride,
+                       const size_t width, const size_t height,
+                       const int64_t x, const int64_t y, const int zoom) {
+    memset(bits, 0, stride * height);
+
+    View view = {bits, width, height, x, y, zoom, 1, stride};
+    renderNode(&view, life->root, life->x, life->y);
+}
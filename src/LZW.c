@@ -3,26 +3,6 @@
 #include <math.h>
 #include "LZW.h"
 
-/**
- * Appends the element to the array extending it if necessary
- *
- * @param arr array to append to
- * @param size size of the array currently
- * @param index position to add to
- * @param code element to add
- */
-static void setCode(uint16_t **arr, size_t *size, size_t index, const uint16_t code) {
-    if(index >= *size) {
-        uint16_t *temp = malloc(sizeof(uint16_t) * 2 * index);
-        memcpy(temp, *arr, *size * sizeof(uint16_t));
-        free(*arr);
-        *size = 2 * index;
-        *arr = temp;
-    }
-
-    (*arr)[index] = code;
-}
-
 /**
  * Appends the element to the array extending it if necessary
  *
@@ -33,11 +13,8 @@ static void setCode(uint16_t **arr, size_t *size, size_t index, const uint16_t c
  */
 static void setChar(char **arr, size_t *size, size_t index, const char ch) {
     if(index >= *size) {
-        char *temp = malloc(sizeof(char) * 2 * index);
-        memcpy(temp, *arr, *size * sizeof(char));
-        free(*arr);
         *size = 2 * index;
-        *arr = temp;
+        *arr = realloc(*arr, sizeof(char) * *size);
     }
 
     (*arr)[index] = ch;
@@ -88,95 +65,388 @@ uint16_t LZW_Free(LZW *state) {
     return result;
 }
 
-void LZW_Compress(const char *string, size_t stringc, uint16_t **code, size_t *codec, uint8_t alphabetSize) {
-    LZW state;
-    LZW_Init(alphabetSize, &state);
+size_t LZW_CompressBound(const size_t stringc) {
+    //one code per byte at most, plus a clear code each time the dictionary
+    //fills (at least 3837 codes apart), the first clear code and the last code
+    return stringc + stringc / 2048 + 2;
+}
 
-    size_t resultLen = 64;
-    uint16_t *result = malloc(sizeof(uint16_t) * resultLen);
-    size_t resultIndex = 0;
+size_t LZW_DecompressBound(const size_t codec) {
+    //each code's string is at most one byte longer than the previous one
+    if(codec > MAX_INDEX) {
+        return codec * (MAX_INDEX + 1);
+    }
+    return codec * (codec + 1) / 2;
+}
+
+void LZW_EncoderInit(LZWEncoder *enc, uint8_t alphabetSize) {
+    enc->alphabetSize = alphabetSize;
+    enc->prefix = LZW_NO_CODE;
+    enc->started = 0;
+    enc->clearWhenFull = 1;
+    enc->lossy = NULL;
+    enc->exact = -1;
+}
+
+void LZW_LossyTableInit(LZWLossyTable *table, const uint8_t *palette,
+                        const size_t numColors, const unsigned int threshold) {
+    memset(table->palette, 0, sizeof(table->palette));
+    memcpy(table->palette, palette, 3 * (numColors < 256 ? numColors : 256));
+    memset(table->similar, 0, sizeof(table->similar));
+    memset(table->hasSimilar, 0, sizeof(table->hasSimilar));
+
+    const uint32_t maxError = threshold * threshold;
+    int a, b;
+    for(a = 0; a < 256; a++) {
+        for(b = a + 1; b < 256; b++) {
+            const uint8_t *colorA = table->palette + 3*a;
+            const uint8_t *colorB = table->palette + 3*b;
+            uint32_t error = 0;
+            int i;
+            for(i = 0; i < 3; i++) {
+                error += (colorA[i] - colorB[i]) * (colorA[i] - colorB[i]);
+            }
+
+            if(error <= maxError) {
+                table->similar[a][b >> 6] |= 1ULL << (b & 63);
+                table->similar[b][a >> 6] |= 1ULL << (a & 63);
+                table->hasSimilar[a] = table->hasSimilar[b] = 1;
+            }
+        }
+    }
+}
+
+void LZW_EncoderSetLossy(LZWEncoder *enc, const LZWLossyTable *table, const int exact) {
+    enc->lossy = table;
+    enc->exact = exact;
+    enc->error[0] = enc->error[1] = enc->error[2] = 0;
+}
+
+/**
+ * Passes part of the color error on to the next byte when a byte is encoded
+ * exactly, so the error fades out instead of building up
+ */
+static void fadeError(LZWEncoder *enc) {
+    enc->error[0] = 3 * enc->error[0] / 4;
+    enc->error[1] = 3 * enc->error[1] / 4;
+    enc->error[2] = 3 * enc->error[2] / 4;
+}
+
+/**
+ * Finds the string to continue the current one with in lossy mode: the exact
+ * byte if the dictionary has it, otherwise the allowed replacement closest to
+ * the byte's color plus the carried error. Part of the difference between
+ * that color and the one given is carried on to the next byte.
+ *
+ * @param enc lossy encoder with a current string
+ * @param ch the next input byte, which has replacements in the table
+ * @return the code of the longer string or 0 to end the current one
+ */
+static uint16_t lossyChild(LZWEncoder *enc, const uint8_t ch) {
+    const uint64_t *similar = enc->lossy->similar[ch];
+    const uint8_t *palette = enc->lossy->palette;
+    const int target[3] = {palette[3*ch] + enc->error[0],
+                           palette[3*ch + 1] + enc->error[1],
+                           palette[3*ch + 2] + enc->error[2]};
+
+    //one pass: stop at the exact byte, remember the closest replacement
+    uint32_t bestError = UINT32_MAX;
+    uint16_t best = 0;
+    uint16_t child;
+    for(child = enc->firstChild[enc->prefix]; child != 0; child = enc->nextSibling[child]) {
+        const uint8_t value = enc->value[child];
+        if(value == ch) {
+            best = child;
+            break;
+        }
+        if(!((similar[value >> 6] >> (value & 63)) & 1) || value == enc->exact) {
+            continue;
+        }
+
+        const uint8_t *color = palette + 3*value;
+        const int dr = target[0] - color[0];
+        const int dg = target[1] - color[1];
+        const int db = target[2] - color[2];
+        const uint32_t error = dr*dr + dg*dg + db*db;
+        if(error < bestError) {
+            bestError = error;
+            best = child;
+        }
+    }
+
+    const uint8_t *chosen = palette + 3*(best != 0 ? enc->value[best] : ch);
+    int i;
+    for(i = 0; i < 3; i++) {
+        enc->error[i] = 3 * (target[i] - chosen[i]) / 4;
+    }
+
+    return best;
+}
+
+/**
+ * Empties the encoder's dictionary, leaving only the single byte strings
+ */
+static void encoderClear(LZWEncoder *enc) {
+    enc->nextCode = enc->alphabetSize + 3; //skip the clear and stop codes
+    memset(enc->firstChild, 0, sizeof(uint16_t) * enc->nextCode);
+}
+
+size_t LZW_CompressChunk(LZWEncoder *enc, const char *string, const size_t stringc,
+                         uint16_t *code, const size_t codec, size_t *written) {
+    const uint16_t clearCode = enc->alphabetSize + 1;
+    size_t codeIndex = 0;
 
     size_t charIndex;
-    for(charIndex = 0; charIndex < stringc; charIndex++) {
-        uint16_t nextCode = LZW_CompressOne(string[charIndex], &state);
-        if(nextCode == alphabetSize + 1) {
-            setCode(&result, &resultLen, resultIndex, nextCode);
-            resultIndex++;
-            nextCode = LZW_CompressOne(string[charIndex], &state);
+    //each byte writes at most two codes
+    for(charIndex = 0; charIndex < stringc && codeIndex + 2 <= codec; charIndex++) {
+        const uint8_t ch = string[charIndex];
+
+        if(!enc->started || (enc->nextCode == MAX_INDEX && enc->clearWhenFull)) {
+            //the first byte, or the dictionary is full
+            code[codeIndex++] = clearCode;
+            encoderClear(enc);
+            enc->started = 1;
+        }
+
+        if(enc->prefix == LZW_NO_CODE) {
+            if(enc->lossy != NULL) {
+                fadeError(enc);
+            }
+            enc->prefix = ch;
+            continue;
+        }
+
+        //look for prefix + ch in the dictionary
+        uint16_t child;
+        if(enc->lossy != NULL && ch != enc->exact && enc->lossy->hasSimilar[ch]) {
+            child = lossyChild(enc, ch);
+        }else{
+            child = enc->firstChild[enc->prefix];
+            while(child != 0 && enc->value[child] != ch) {
+                child = enc->nextSibling[child];
+            }
+            if(enc->lossy != NULL) {
+                fadeError(enc);
+            }
         }
 
-        if(nextCode != 0xffff) {
-            setCode(&result, &resultLen, resultIndex, nextCode);
-            resultIndex++;
+        if(child != 0) {
+            enc->prefix = child;
+        }else{
+            code[codeIndex++] = enc->prefix;
+
+            //a full dictionary that is not cleared stops growing
+            if(enc->nextCode < MAX_INDEX) {
+                enc->value[enc->nextCode] = ch;
+                enc->firstChild[enc->nextCode] = 0;
+                enc->nextSibling[enc->nextCode] = enc->firstChild[enc->prefix];
+                enc->firstChild[enc->prefix] = enc->nextCode;
+                enc->nextCode++;
+            }
+
+            enc->prefix = ch;
         }
     }
 
-    uint16_t lastCode = LZW_Free(&state);
-    setCode(&result, &resultLen, resultIndex, lastCode);
-    resultIndex++;
+    *written = codeIndex;
+    return charIndex;
+}
+
+size_t LZW_CompressFinish(LZWEncoder *enc, uint16_t *code, const size_t codec) {
+    if(enc->prefix == LZW_NO_CODE || codec < 1) {
+        return 0;
+    }
+
+    code[0] = enc->prefix;
+    enc->prefix = LZW_NO_CODE;
+
+    //the decoder adds one more string after reading the last code, keep
+    //nextCode in step so the caller can size the code that follows
+    if(enc->nextCode <= MAX_INDEX) {
+        enc->nextCode++;
+    }
 
-    *code = result;
-    *codec = resultIndex;
+    return 1;
 }
 
-void LZW_Decompress(const uint16_t *code, const size_t codec, char **string, uint8_t alphabetSize) {
-    Dictionary dict;
-    dict_init(&dict, alphabetSize);
+int LZW_CompressBuf(const char *string, const size_t stringc,
+                    uint16_t *code, const size_t codec, size_t *written,
+                    uint8_t alphabetSize) {
+    LZWEncoder enc;
+    LZW_EncoderInit(&enc, alphabetSize);
 
-    size_t symLen = 16;
-    uint8_t *currSym = malloc(sizeof(uint8_t) * symLen);
-    size_t symIndex = 0;
+    size_t used = LZW_CompressChunk(&enc, string, stringc, code, codec, written);
+    if(used < stringc) {
+        return 0;
+    }
 
-    size_t resultLen = 32;
-    char *result = malloc(sizeof(char) * resultLen);
-    size_t resultIndex = 0;
+    if(stringc > 0) {
+        if(LZW_CompressFinish(&enc, code + *written, codec - *written) == 0) {
+            return 0;
+        }
+        (*written)++;
+    }
+
+    return 1;
+}
+
+void LZW_DecoderInit(LZWDecoder *dec, uint8_t alphabetSize) {
+    dec->alphabetSize = alphabetSize;
+    dec->nextCode = alphabetSize + 3;
+    dec->oldCode = LZW_NO_CODE;
+    dec->pendingCode = LZW_NO_CODE;
+    dec->pendingOffset = 0;
+    dec->error = 0;
 
     int i;
-    for(i = 0; i < codec; i++) {
-        uint8_t *phrase = NULL;
-        size_t phraseLen;
-
-        //If the clear code shows up reset the dictionary
-        if(code[i] == dict.clearCode) {
-            dict_free(&dict);
-            dict_init(&dict, alphabetSize);
-            continue;
+    for(i = 0; i <= alphabetSize; i++) {
+        dec->prefix[i] = LZW_NO_CODE;
+        dec->suffix[i] = dec->first[i] = i;
+        dec->length[i] = 1;
+    }
+}
+
+/**
+ * Writes part of the string for a code
+ *
+ * @param dec decoder the code belongs to
+ * @param code code to write the string of
+ * @param offset position in the string to start at
+ * @param string buffer to write to
+ * @param stringc room in the buffer
+ * @return the number of bytes written
+ */
+static size_t writeString(const LZWDecoder *dec, uint16_t code, const size_t offset,
+                          char *string, const size_t stringc) {
+    size_t end = dec->length[code];
+    if(end - offset > stringc) {
+        end = offset + stringc;
+    }
+
+    //walk back from the last byte, skipping the ones past the end
+    size_t i;
+    for(i = dec->length[code]; i > offset; i--) {
+        if(i <= end) {
+            string[i - 1 - offset] = dec->suffix[code];
         }
+        code = dec->prefix[code];
+    }
 
-        if(dict_search(&dict, code[i], &phrase, &phraseLen)) {
-            //output phrase
-            resultIndex += phraseLen;
-            setChar(&result, &resultLen, resultIndex, '\0');
-            memcpy(result + resultIndex - phraseLen, phrase, phraseLen);
+    return end - offset;
+}
+
+size_t LZW_DecompressChunk(LZWDecoder *dec, const uint16_t *code, const size_t codec,
+                           char *string, const size_t stringc, size_t *consumed) {
+    const uint16_t clearCode = dec->alphabetSize + 1;
+    const uint16_t stopCode = dec->alphabetSize + 2;
+    size_t stringIndex = 0;
+    size_t codeIndex = 0;
 
-            //Add currSym + phrase[0] to dictionary
-            setChar((char **) &currSym, &symLen, symIndex, phrase[0]);
-            if(symIndex > 0) { //if == 0 its already in the dictionary
-                dict_add(&dict, currSym, symIndex+1);
+    while(1) {
+        //finish the string from the last call or code first
+        if(dec->pendingCode != LZW_NO_CODE) {
+            size_t n = writeString(dec, dec->pendingCode, dec->pendingOffset,
+                                   string + stringIndex, stringc - stringIndex);
+            stringIndex += n;
+            dec->pendingOffset += n;
+            if(dec->pendingOffset < dec->length[dec->pendingCode]) {
+                break; //out of room
             }
+            dec->pendingCode = LZW_NO_CODE;
+        }
 
-            //currSym = phrase
-            free(currSym);
-            currSym = phrase;
-            symLen = symIndex = phraseLen;
-        }else{
-            //currSym += currSym[0]
-            setChar((char **)&currSym, &symLen, symIndex, currSym[0]);
-            symIndex++;
-
-            //output currSym
-            resultIndex += symIndex;
-            setChar(&result, &resultLen, resultIndex, '\0');
-            memcpy(result + resultIndex - symIndex, currSym, symIndex);
-
-            //add currSym to dictionary
-            dict_add(&dict, currSym, symIndex);
-            free(phrase); //allocated in dict_search
+        if(codeIndex == codec) {
+            break;
+        }
+
+        const uint16_t next = code[codeIndex];
+        if(next == clearCode) {
+            dec->nextCode = dec->alphabetSize + 3;
+            dec->oldCode = LZW_NO_CODE;
+            codeIndex++;
+            continue;
+        }else if(next == stopCode) {
+            codeIndex++;
+            break;
+        }
+
+        if(dec->oldCode == LZW_NO_CODE) {
+            //the first code after a clear must be a single byte
+            if(next > dec->alphabetSize) {
+                dec->error = 1;
+                break;
+            }
+        }else if(next > dec->nextCode || next > MAX_INDEX) {
+            //a full table has no room for the code after its last one
+            dec->error = 1;
+            break;
+        }else if(dec->nextCode <= MAX_INDEX) {
+            //the new string is the old one plus the first byte of this one,
+            //which is the old one's first byte if this is the new string
+            const uint16_t add = dec->nextCode;
+            dec->prefix[add] = dec->oldCode;
+            dec->suffix[add] = next == add ? dec->first[dec->oldCode] : dec->first[next];
+            dec->first[add] = dec->first[dec->oldCode];
+            dec->length[add] = dec->length[dec->oldCode] + 1;
+            dec->nextCode++;
         }
+
+        dec->oldCode = next;
+        dec->pendingCode = next;
+        dec->pendingOffset = 0;
+        codeIndex++;
+    }
+
+    *consumed = codeIndex;
+    return stringIndex;
+}
+
+int LZW_DecompressBuf(const uint16_t *code, const size_t codec,
+                      char *string, const size_t stringc, size_t *written,
+                      uint8_t alphabetSize) {
+    LZWDecoder dec;
+    LZW_DecoderInit(&dec, alphabetSize);
+
+    size_t consumed;
+    *written = LZW_DecompressChunk(&dec, code, codec, string, stringc, &consumed);
+
+    return !dec.error && consumed == codec && dec.pendingCode == LZW_NO_CODE;
+}
+
+void LZW_Compress(const char *string, size_t stringc, uint16_t **code, size_t *codec, uint8_t alphabetSize) {
+    size_t bound = LZW_CompressBound(stringc);
+    *code = malloc(sizeof(uint16_t) * bound);
+    LZW_CompressBuf(string, stringc, *code, bound, codec, alphabetSize);
+}
+
+void LZW_Decompress(const uint16_t *code, const size_t codec, char **string, uint8_t alphabetSize) {
+    LZWDecoder *dec = malloc(sizeof(LZWDecoder));
+    LZW_DecoderInit(dec, alphabetSize);
+
+    size_t resultLen = 32;
+    char *result = malloc(sizeof(char) * resultLen);
+    size_t resultIndex = 0;
+
+    //decompress until everything fits, doubling the buffer each time
+    size_t codeIndex = 0;
+    while(1) {
+        size_t consumed;
+        resultIndex += LZW_DecompressChunk(dec, code + codeIndex, codec - codeIndex,
+                                           result + resultIndex, resultLen - resultIndex - 1,
+                                           &consumed);
+        codeIndex += consumed;
+
+        //stopped for any reason other than running out of room
+        if(dec->error || resultIndex < resultLen - 1) {
+            break;
+        }
+
+        resultLen *= 2;
+        result = realloc(result, sizeof(char) * resultLen);
     }
 
+    result[resultIndex] = '\0';
     *string = result;
 
-    free(currSym);
-    dict_free(&dict);
+    free(dec);
 }
@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include "Pool.h"
+
+typedef struct TaskT {
+    void (*run)(void *);
+    void *arg;
+    struct TaskT *next;
+} Task;
+
+struct Pool_priv {
+    pthread_mutex_t lock;
+    pthread_cond_t workReady;  //signalled when a task is queued or on exit
+    pthread_cond_t workDone;   //signalled when the last running task finishes
+
+    Task *head;                //queue of tasks not started yet
+    Task *tail;
+    size_t pending;            //tasks queued or running
+    int stopping;
+
+    pthread_t *threads;
+    unsigned int numThreads;
+};
+
+static void *worker(void *arg) {
+    Pool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while(1) {
+        while(pool->head == NULL && !pool->stopping) {
+            pthread_cond_wait(&pool->workReady, &pool->lock);
+        }
+
+        if(pool->head == NULL) { //stopping and nothing left to do
+            break;
+        }
+
+        Task *task = pool->head;
+        pool->head = task->next;
+        if(pool->head == NULL) {
+            pool->tail = NULL;
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+        task->run(task->arg);
+        free(task);
+        pthread_mutex_lock(&pool->lock);
+
+        pool->pending--;
+        if(pool->pending == 0) {
+            pthread_cond_broadcast(&pool->workDone);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+Pool *pool_init(const unsigned int numThreads) {
+    Pool *pool = malloc(sizeof(Pool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->workReady, NULL);
+    pthread_cond_init(&pool->workDone, NULL);
+    pool->head = pool->tail = NULL;
+    pool->pending = 0;
+    pool->stopping = 0;
+
+    pool->threads = malloc(sizeof(pthread_t) * numThreads);
+    for(pool->numThreads = 0; pool->numThreads < numThreads; pool->numThreads++) {
+        if(pthread_create(pool->threads + pool->numThreads, NULL, worker, pool) != 0) {
+            break;
+        }
+    }
+
+    if(pool->numThreads == 0) {
+        pool_free(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+unsigned int pool_numThreads(const Pool *pool) {
+    return pool->numThreads;
+}
+
+void pool_submit(Pool *pool, void (*run)(void *), void *arg) {
+    Task *task = malloc(sizeof(Task));
+    task->run = run;
+    task->arg = arg;
+    task->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if(pool->tail == NULL) {
+        pool->head = task;
+    }else{
+        pool->tail->next = task;
+    }
+    pool->tail = task;
+    pool->pending++;
+    pthread_cond_signal(&pool->workReady);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_wait(Pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while(pool->pending > 0) {
+        pthread_cond_wait(&pool->workDone, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_free(Pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->workReady);
+    pthread_mutex_unlock(&pool->lock);
+
+    unsigned int i;
+    for(i = 0; i < pool->numThreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->workDone);
+    pthread_cond_destroy(&pool->workReady);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
@@ -0,0 +1,345 @@
+/**
+ * Makes a gif from raw frames of palette indices.
+ *
+ * The input is width*height bytes per frame, one color index per pixel, back
+ * to back. A file is mapped into memory and its frames are compressed in
+ * place; standard input is read one frame at a time. Either way frames are
+ * compressed on the gif's threads while the next ones are being read, and the
+ * file is written as each frame finishes.
+ *
+ * usage: tinygif-encode -w width -h height -p palette.rgb [-d delay]
+ *                       [-l loops] [-q lossy] [-b bytes [-n frames]]
+ *                       [-j threads] [-o out.gif] [frames | -]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "Gif.h"
+
+#define MAX_COLORS 256
+
+/**
+ * Frame buffers for standard input, reused once the gif releases them
+ */
+typedef struct {
+    unsigned char **free;   //buffers that can be read into
+    size_t numFree;
+    size_t capacity;
+    size_t frameSize;
+} Buffers;
+
+/**
+ * Sink that writes to a file and counts the bytes
+ */
+typedef struct {
+    FILE *file;
+    size_t size;
+} Output;
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static size_t outputWrite(const void *data, size_t size, void *user) {
+    Output *out = user;
+    size_t written = fwrite(data, 1, size, out->file);
+    out->size += written;
+    return written;
+}
+
+/**
+ * Checks that every pixel of a frame is a color of the palette
+ *
+ * @return 1 if the frame is valid, 0 after printing the first bad index
+ */
+static int checkFrame(const unsigned char *frame, const size_t frameSize,
+                      const unsigned short numColors, const long frameIndex) {
+    size_t i;
+    for(i = 0; numColors < MAX_COLORS && i < frameSize; i++) {
+        if(frame[i] >= numColors) {
+            fprintf(stderr, "frame %ld: color index %d at pixel %zu is past the %d color palette\n",
+                    frameIndex, frame[i], i, numColors);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static unsigned char *takeBuffer(Buffers *buffers) {
+    if(buffers->numFree > 0) {
+        return buffers->free[--buffers->numFree];
+    }
+    return malloc(buffers->frameSize);
+}
+
+/**
+ * Release function for frames read from standard input, called on the main
+ * thread so the free list needs no lock
+ */
+static void returnBuffer(const unsigned char *data, void *user) {
+    Buffers *buffers = user;
+    if(buffers->numFree == buffers->capacity) {
+        buffers->capacity = buffers->capacity > 0 ? 2 * buffers->capacity : 8;
+        buffers->free = realloc(buffers->free, sizeof(unsigned char *) * buffers->capacity);
+    }
+    buffers->free[buffers->numFree++] = (unsigned char *) data;
+}
+
+/**
+ * Reads a raw RGB palette, padded with black to a power of two colors
+ *
+ * @param fileName file with 3 bytes per color
+ * @param colors returns the palette, MAX_COLORS*3 bytes
+ * @return the number of colors in the padded palette, 0 on error
+ */
+static unsigned short readPalette(const char *fileName, unsigned char *colors) {
+    FILE *file = fopen(fileName, "rb");
+    if(file == NULL) {
+        return 0;
+    }
+
+    memset(colors, 0, MAX_COLORS*3);
+    size_t size = fread(colors, 1, MAX_COLORS*3, file);
+    int extra = fgetc(file);
+    fclose(file);
+    if(size < 3 || size % 3 != 0 || extra != EOF) {
+        return 0;
+    }
+
+    unsigned short numColors = 2;
+    while(numColors < size / 3) {
+        numColors *= 2;
+    }
+    return numColors;
+}
+
+/**
+ * Queues every whole frame of a mapped file
+ *
+ * @param numColors colors in the palette, frames must not use others
+ * @param budget size limit of the gif, 0 for none
+ * @return the number of frames, or -1 after printing an error
+ */
+static long encodeFile(Gif *gif, const char *fileName, const size_t frameSize,
+                       const unsigned short numColors, const unsigned short delay,
+                       const size_t budget) {
+    int fd = open(fileName, O_RDONLY);
+    struct stat info;
+    if(fd < 0 || fstat(fd, &info) != 0) {
+        perror(fileName);
+        if(fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    const size_t size = info.st_size;
+    const size_t numFrames = size / frameSize;
+    if(size % frameSize != 0) {
+        fprintf(stderr, "%s: ignoring %zu bytes after the last whole frame\n",
+                fileName, size % frameSize);
+    }
+    if(numFrames == 0) {
+        close(fd);
+        return 0;
+    }
+
+    unsigned char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) {
+        perror(fileName);
+        return -1;
+    }
+    posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+    GIF_SetBudget(gif, budget, numFrames);
+
+    //the mapping outlives the gif's use of it, nothing to release
+    size_t i;
+    for(i = 0; i < numFrames; i++) {
+        if(!checkFrame(data + i*frameSize, frameSize, numColors, i)) {
+            break;
+        }
+        GIF_QueueImage(gif, data + i*frameSize, delay, NULL, NULL);
+    }
+
+    //store the queued frames before the mapping goes away
+    GIF_FlushQueue(gif);
+    munmap(data, size);
+
+    return i == numFrames ? (long) numFrames : -1;
+}
+
+/**
+ * Queues frames from standard input as they are read
+ *
+ * @param numColors colors in the palette, frames must not use others
+ * @param budget size limit of the gif, 0 for none
+ * @param expectedFrames frames the budget is shared over
+ * @return the number of frames, or -1 after printing an error
+ */
+static long encodeStream(Gif *gif, const size_t frameSize, const unsigned short numColors,
+                         const unsigned short delay, const size_t budget,
+                         const size_t expectedFrames) {
+    Buffers buffers = {NULL, 0, 0, frameSize};
+    long numFrames = 0;
+    GIF_SetBudget(gif, budget, expectedFrames);
+
+    for(;;) {
+        unsigned char *frame = takeBuffer(&buffers);
+        size_t size = fread(frame, 1, frameSize, stdin);
+        if(size < frameSize) {
+            if(size > 0) {
+                fprintf(stderr, "stdin: ignoring %zu bytes after the last whole frame\n", size);
+            }
+            free(frame);
+            break;
+        }
+        if(!checkFrame(frame, frameSize, numColors, numFrames)) {
+            free(frame);
+            numFrames = -1;
+            break;
+        }
+
+        GIF_QueueImage(gif, frame, delay, returnBuffer, &buffers);
+        numFrames++;
+    }
+
+    //every buffer comes back once the queue is empty
+    GIF_FlushQueue(gif);
+    while(buffers.numFree > 0) {
+        free(buffers.free[--buffers.numFree]);
+    }
+    free(buffers.free);
+
+    return numFrames;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s -w width -h height -p palette.rgb [-d delay] [-l loops]\n"
+                    "       [-q lossy] [-b bytes [-n frames]] [-j threads] [-o out.gif]\n"
+                    "       [frames | -]\n", name);
+    fprintf(stderr, "  frames  width*height color indices per frame (default: stdin)\n");
+    fprintf(stderr, "  -p  3 bytes of RGB per color, up to %d colors\n", MAX_COLORS);
+    fprintf(stderr, "  -d  hundredths of a second per frame (default: 0)\n");
+    fprintf(stderr, "  -l  times to repeat, 0 forever, -1 play once (default: 0)\n");
+    fprintf(stderr, "  -q  how far colors may change to compress better, 0 to 441 (default: 0)\n");
+    fprintf(stderr, "  -b  largest gif to write, colors change and frames drop to fit; picks\n"
+                    "      its own lossy level, so it can't be used with -q\n");
+    fprintf(stderr, "  -n  frames on stdin the -b bytes are shared over (default: 100)\n");
+    fprintf(stderr, "  -j  compression threads (default: one per CPU)\n");
+    fprintf(stderr, "  -o  file to write (default: stdout)\n");
+}
+
+int main(int argc, char *argv[]) {
+    long width = 0, height = 0, delay = 0, loops = 0, lossy = 0;
+    long budget = 0, expectedFrames = 100;
+    long numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *paletteName = NULL;
+    const char *outName = NULL;
+
+    int opt;
+    while((opt = getopt(argc, argv, "w:h:p:d:l:q:b:n:j:o:")) != -1) {
+        if(opt == 'w') {
+            width = atol(optarg);
+        }else if(opt == 'h') {
+            height = atol(optarg);
+        }else if(opt == 'p') {
+            paletteName = optarg;
+        }else if(opt == 'd') {
+            delay = atol(optarg);
+        }else if(opt == 'l') {
+            loops = atol(optarg);
+        }else if(opt == 'q') {
+            lossy = atol(optarg);
+        }else if(opt == 'b') {
+            budget = atol(optarg);
+        }else if(opt == 'n') {
+            expectedFrames = atol(optarg);
+        }else if(opt == 'j') {
+            numThreads = atol(optarg);
+        }else if(opt == 'o') {
+            outName = optarg;
+        }else{
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if(width < 1 || width > 0xFFFF || height < 1 || height > 0xFFFF ||
+       delay < 0 || delay > 0xFFFF || loops < -1 || loops > 0xFFFF ||
+       lossy < 0 || lossy > 441 || budget < 0 || expectedFrames < 1 ||
+       (budget > 0 && lossy > 0) || numThreads < 1 || paletteName == NULL ||
+       argc - optind > 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char *inName = optind < argc && strcmp(argv[optind], "-") != 0 ? argv[optind] : NULL;
+
+    unsigned char colors[MAX_COLORS*3];
+    const unsigned short numColors = readPalette(paletteName, colors);
+    if(numColors == 0) {
+        fprintf(stderr, "%s: not a palette of 1 to %d RGB colors\n", paletteName, MAX_COLORS);
+        return 1;
+    }
+
+    Output out = {outName != NULL ? fopen(outName, "wb") : stdout, 0};
+    if(out.file == NULL) {
+        perror(outName);
+        return 1;
+    }
+
+    double start = now();
+    Gif *gif = GIF_Init(width, height, colors, numColors, 0);
+    GIF_SetRepeat(gif, loops);
+    GIF_SetThreads(gif, numThreads);
+    GIF_SetLossy(gif, lossy);
+    GIF_SetSink(gif, outputWrite, &out);
+
+    const size_t frameSize = (size_t) width * height;
+    long numFrames = inName != NULL ? encodeFile(gif, inName, frameSize, numColors, delay, budget)
+                                    : encodeStream(gif, frameSize, numColors, delay,
+                                                   budget, expectedFrames);
+
+    int failed = numFrames < 0;
+    if(!failed && !GIF_Finish(gif)) {
+        if(budget > 0 && out.size > (size_t) budget) {
+            fprintf(stderr, "could not fit the gif in %ld bytes\n", budget);
+        }else{
+            fprintf(stderr, "%s: write failed\n", outName != NULL ? outName : "stdout");
+        }
+        failed = 1;
+    }
+    //frames the budget dropped or merged into the one before are not in the file
+    const size_t numWritten = GIF_NumFrames(gif);
+    GIF_Free(gif);
+
+    if(outName != NULL && fclose(out.file) != 0) {
+        failed = 1;
+    }
+    //a partial gif has no trailer, don't leave it looking like a result
+    if(failed && outName != NULL) {
+        remove(outName);
+    }
+
+    if(!failed && numWritten < (size_t) numFrames) {
+        fprintf(stderr, "%zu of %ld frames, %zu bytes in %.1f ms\n",
+                numWritten, numFrames, out.size, 1000.0 * (now() - start));
+    }else if(!failed) {
+        fprintf(stderr, "%ld frames, %zu bytes in %.1f ms\n",
+                numFrames, out.size, 1000.0 * (now() - start));
+    }
+
+    return failed;
+}
@@ -1,9 +1,9 @@
 /**
- * Creates an uncompressed gif file which displays an animation of conway's
- * game of life.
+ * Creates a gif file which displays an animation of conway's game of life.
  *
- * Avoids using LZW because of the code length requirement, although I could
- * have added a hash map and an LZW function.
+ * The universe is simulated with Hashlife (see Hashlife.h) so it is unbounded
+ * and can be advanced many generations per frame; each frame draws a window of
+ * it.
  *
  * Author: Andrew Kallmeyer
  * Created on 2014-2-1
@@ -11,14 +11,22 @@
 
 #include <time.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include "Gif.h"
+#include "Hashlife.h"
 
 #define WIDTH  250
 #define HEIGHT 250
-static const unsigned short NUM_ITERATIONS = 124;
+#define STRIDE ((WIDTH + 7) / 8) //bytes per row of the bitmap
+static const unsigned short NUM_ITERATIONS = 1024;
 static const unsigned short DELAY_TIME = 100/40; //100/FPS
 
+//each cell is 2^ZOOM pixels wide, negative values show several cells per pixel
+static const int ZOOM = 1;
+//each frame advances 2^STEP_LOG2 generations
+static const int STEP_LOG2 = 0;
+
 static const unsigned char NUM_COLORS = 4;
 static const unsigned char COLOR_TABLE[12] = {
     0x00, 0x00, 0x00, //black
@@ -26,26 +34,56 @@ static const unsigned char COLOR_TABLE[12] = {
     0xFF, 0xAA, 0x00, //orange
     0x00, 0x00, 0x00};//black, unused
 
-//these states are color table indicies
-typedef enum {
-    DEAD  = 0,
-    ALIVE = 2
-} State;
+//color table indicies of dead (0 bits) and live (1 bits) cells
+static const unsigned char STATE_COLORS[2] = {0, 2};
 
 static const unsigned short NUM_REPEATS = 0xFFFF;
 
-unsigned char cells[WIDTH*HEIGHT];
+//longest repeating cycle of frames that is detected
+#define MAX_PERIOD 64
+
+//Gosper glider gun
+static const char *PATTERN =
+    "#N Gosper glider gun\n"
+    "x = 36, y = 9, rule = B3/S23\n"
+    "24bo$22bobo$12b2o6b2o12b2o$11bo3bo4b2o12b2o$2o8bo5bo3b2o$2o8bo3bob2o4b"
+    "obo$10bo5bo7bo$11bo3bo$12b2o!";
 
-void setCell(int x, int y, State state) {
-    if(x >= 0 && x < WIDTH/2 && y >= 0 && y < HEIGHT/2) {
-        cells[x*2     + WIDTH * (y*2)    ] = (unsigned char) state;
-        cells[x*2 + 1 + WIDTH * (y*2)    ] = (unsigned char) state;
-        cells[x*2     + WIDTH * (y*2 + 1)] = (unsigned char) state;
-        cells[x*2 + 1 + WIDTH * (y*2 + 1)] = (unsigned char) state;
+unsigned char cells[STRIDE*HEIGHT];
+//the last MAX_PERIOD frames, to compare when their hashes match
+unsigned char history[MAX_PERIOD][STRIDE*HEIGHT];
+
+/**
+ * 64 bit FNV-1a hash of a frame
+ */
+static uint64_t hashFrame(const unsigned char *frame, size_t size) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    size_t i;
+    for(i = 0; i < size; i++) {
+        hash = (hash ^ frame[i]) * 0x100000001B3ULL;
     }
+    return hash;
 }
 
-void iterate(unsigned char *cells) {
+/**
+ * Looks for an earlier frame with the same pixels, only comparing frames whose
+ * hashes match
+ *
+ * @param hashes ring buffer of the hashes of the last MAX_PERIOD frames, with
+ * the frames themselves in history
+ * @param frame index of the current frame
+ * @param hash hash of the current frame, which is in cells
+ * @return the number of frames since the same frame was seen, 0 if it was not
+ */
+static int findPeriod(const uint64_t *hashes, int frame, uint64_t hash) {
+    int period;
+    for(period = 1; period <= MAX_PERIOD && period <= frame; period++) {
+        const int index = (frame - period) % MAX_PERIOD;
+        if(hashes[index] == hash && memcmp(history[index], cells, STRIDE*HEIGHT) == 0) {
+            return period;
+        }
+    }
+    return 0;
 }
 
 int main(int argc, char *argv[]) {
@@ -53,30 +91,49 @@ int main(int argc, char *argv[]) {
     Gif *gif = GIF_Init(WIDTH, HEIGHT, COLOR_TABLE, NUM_COLORS, NUM_REPEATS);
     printf("Init time: %f ms\n", 1000.0*(clock() - last)/CLOCKS_PER_SEC);
 
+    Life life;
+    life_init(&life);
+    life_loadRLE(&life, PATTERN, 2, 2);
+    life_setStep(&life, STEP_LOG2);
+
     double elapsed = 0.0;
+    double simulated = 0.0;
+    uint64_t hashes[MAX_PERIOD];
+
+    int i;
+    for(i = 0; i < NUM_ITERATIONS; i++) {
+        last = clock();
+        life_renderBitmap(&life, cells, STRIDE, WIDTH, HEIGHT, 0, 0, ZOOM);
+        life_step(&life);
+        simulated += (double)(clock() - last) / CLOCKS_PER_SEC;
 
-    int off;
-    for(off = -3; off < NUM_ITERATIONS; off++) {
-        memset(cells, 1, WIDTH*HEIGHT);
-        setCell(1 + off, 0 + off, ALIVE);
-        setCell(2 + off, 1 + off, ALIVE);
-        setCell(0 + off, 2 + off, ALIVE);
-        setCell(1 + off, 2 + off, ALIVE);
-        setCell(2 + off, 2 + off, ALIVE);
+        //only the WIDTHxHEIGHT view is compared, the universe past it may
+        //still be changing. The animation ends one period after the view
+        //starts repeating; the repeat extension then loops the whole of it,
+        //so the frames before the cycle play again each time
+        uint64_t hash = hashFrame(cells, STRIDE*HEIGHT);
+        int period = findPeriod(hashes, i, hash);
+        if(period != 0) {
+            printf("Found a cycle of %d frames after %d frames\n", period, i);
+            break;
+        }
+        hashes[i % MAX_PERIOD] = hash;
+        memcpy(history[i % MAX_PERIOD], cells, STRIDE*HEIGHT);
 
-        //iterate(cells);
         last = clock();
-        GIF_AddImage(gif, cells, DELAY_TIME);
+        GIF_AddBitmap(gif, cells, STRIDE, STATE_COLORS, 0, 0, WIDTH, HEIGHT, DELAY_TIME);
         elapsed += (double)(clock() - last) / CLOCKS_PER_SEC;
     }
 
-    printf("Time per frame: %f ms\n", 1000.0*elapsed/NUM_ITERATIONS);
+    printf("Simulation time per frame: %f ms\n", 1000.0*simulated/i);
+    printf("Time per frame: %f ms\n", 1000.0*elapsed/i);
 
     last = clock();
     GIF_Write(gif, "./out.gif");
     printf("Write time: %f ms\n", 1000.0*(clock() - last)/CLOCKS_PER_SEC);
     last = clock();
     GIF_Free(gif);
+    life_free(&life);
     printf("Free time: %f ms\n", 1000.0*(clock() - last)/CLOCKS_PER_SEC);
 
     return 0;
@@ -0,0 +1,626 @@
+/**
+ * Makes existing gif files smaller without changing how they look.
+ *
+ * Each file is decoded and encoded again: identical frames are merged, each
+ * frame only stores the rectangle that changed (with unchanged pixels in it
+ * made transparent), the colors are sorted by use so frames get the smallest
+ * LZW code size, and each piece of a frame picks the better of clearing and
+ * keeping a full dictionary. The result is decoded and compared against the
+ * original before it is kept, and files are processed in parallel.
+ *
+ * usage: tinygif-optimize [-j threads] [-o suffix] file.gif...
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "Gif.h"
+
+//size of the color hash table, more than 256 colors can't be a gif palette
+#define COLOR_SLOTS 512
+static const char *DEFAULT_SUFFIX = ".opt.gif";
+
+/**
+ * Colors used by a gif, counted so the common ones get the low indices
+ */
+typedef struct {
+    uint32_t color[COLOR_SLOTS];          //RGBA as stored on the canvas
+    unsigned long count[COLOR_SLOTS];     //0 for an empty slot
+    unsigned char index[COLOR_SLOTS];     //palette index once sorted
+    size_t numColors;
+    int hasTransparent;                   //1 if any pixel is transparent
+} ColorTable;
+
+/**
+ * Reads a gif's frames, merging identical frames into one longer frame
+ */
+typedef struct {
+    GifDecoder *dec;
+    size_t size;             //bytes in a canvas
+    unsigned char *decoded;  //canvas the decoder draws on
+    unsigned char *frame;    //the frame returned by readerNext
+    unsigned char *next;     //the frame after it, valid if nextStatus is 1
+    int nextStatus;          //GIF_DecodeFrame's result for the next frame
+    unsigned short nextDelay;
+} FrameReader;
+
+/**
+ * One file of the batch
+ */
+typedef struct {
+    const char *inName;
+    char *outName;
+    size_t inSize;
+    size_t outSize;
+    double seconds;
+    const char *error;       //NULL if the file was written
+    int kept;                //1 if the original was written unchanged
+} Job;
+
+/**
+ * The files to optimize, handed out to the threads one at a time
+ */
+typedef struct {
+    Job *jobs;
+    size_t numJobs;
+    size_t nextJob;
+    pthread_mutex_t lock;
+} Batch;
+
+static unsigned char *readFile(const char *fileName, size_t *size) {
+    FILE *file = fopen(fileName, "rb");
+    if(!file) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    unsigned char *data = length > 0 ? malloc(length) : NULL;
+    if(data != NULL && fread(data, 1, length, file) != (size_t) length) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+
+    *size = length;
+    return data;
+}
+
+static int writeFile(const char *fileName, const unsigned char *data, const size_t size) {
+    FILE *file = fopen(fileName, "wb");
+    if(!file) {
+        return 0;
+    }
+
+    int ok = fwrite(data, 1, size, file) == size;
+    return fclose(file) == 0 && ok;
+}
+
+static size_t fileWrite(const void *data, size_t size, void *user) {
+    return fwrite(data, 1, size, user);
+}
+
+/**
+ * @return 1 if both names are the same file
+ */
+static int sameFile(const char *a, const char *b) {
+    struct stat infoA, infoB;
+    if(strcmp(a, b) == 0) {
+        return 1;
+    }
+
+    return stat(a, &infoA) == 0 && stat(b, &infoB) == 0 &&
+            infoA.st_dev == infoB.st_dev && infoA.st_ino == infoB.st_ino;
+}
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static uint32_t pixelAt(const unsigned char *canvas, const size_t i) {
+    uint32_t pixel;
+    memcpy(&pixel, canvas + 4*i, 4);
+    return pixel;
+}
+
+static int isTransparent(const unsigned char *canvas, const size_t i) {
+    return canvas[4*i + 3] == 0;
+}
+
+/**
+ * Reads the next frame from the decoder into the reader's next frame
+ */
+static void readAhead(FrameReader *reader) {
+    GIF_FrameInfo info;
+    reader->nextStatus = GIF_DecodeFrame(reader->dec, reader->decoded, &info);
+    if(reader->nextStatus == 1) {
+        memcpy(reader->next, reader->decoded, reader->size);
+        reader->nextDelay = info.delayTime;
+    }
+}
+
+/**
+ * Opens a gif for reading merged frames
+ *
+ * @return 1 on success, 0 if the data is not a gif
+ */
+static int readerInit(FrameReader *reader, const unsigned char *data, const size_t size) {
+    reader->dec = GIF_DecoderOpen(data, size);
+    if(reader->dec == NULL) {
+        return 0;
+    }
+
+    reader->size = 4 * (size_t) GIF_DecoderWidth(reader->dec) * GIF_DecoderHeight(reader->dec);
+    reader->decoded = malloc(reader->size);
+    reader->frame = malloc(reader->size);
+    reader->next = malloc(reader->size);
+    readAhead(reader);
+
+    return 1;
+}
+
+static void readerRewind(FrameReader *reader) {
+    GIF_DecoderRewind(reader->dec);
+    readAhead(reader);
+}
+
+/**
+ * Reads the next frame, adding the delays of the identical frames after it
+ *
+ * @param reader reader to read from, the frame is left in reader->frame
+ * @param delay returns the total delay of the merged frames
+ * @return 1 if a frame was read, 0 at the end, -1 if the data is corrupt
+ */
+static int readerNext(FrameReader *reader, unsigned int *delay) {
+    if(reader->nextStatus != 1) {
+        return reader->nextStatus;
+    }
+
+    unsigned char *temp = reader->frame;
+    reader->frame = reader->next;
+    reader->next = temp;
+    *delay = reader->nextDelay;
+
+    readAhead(reader);
+    while(reader->nextStatus == 1 && *delay + reader->nextDelay <= 0xFFFF &&
+            memcmp(reader->frame, reader->next, reader->size) == 0) {
+        *delay += reader->nextDelay;
+        readAhead(reader);
+    }
+
+    return 1;
+}
+
+static void readerFree(FrameReader *reader) {
+    GIF_DecoderFree(reader->dec);
+    free(reader->decoded);
+    free(reader->frame);
+    free(reader->next);
+}
+
+static size_t colorSlot(const ColorTable *table, const uint32_t color) {
+    size_t slot = (color * 2654435761u) % COLOR_SLOTS;
+    while(table->count[slot] != 0 && table->color[slot] != color) {
+        slot = (slot + 1) % COLOR_SLOTS;
+    }
+    return slot;
+}
+
+/**
+ * Counts the colors of every frame
+ *
+ * @return 1 on success, 0 if there are too many colors for one palette or
+ * the data is corrupt
+ */
+static int countColors(FrameReader *reader, ColorTable *table) {
+    memset(table, 0, sizeof(ColorTable));
+
+    unsigned int delay;
+    int status;
+    while((status = readerNext(reader, &delay)) == 1) {
+        size_t i;
+        for(i = 0; i < reader->size / 4; i++) {
+            if(isTransparent(reader->frame, i)) {
+                table->hasTransparent = 1;
+                continue;
+            }
+
+            const uint32_t color = pixelAt(reader->frame, i);
+            size_t slot = colorSlot(table, color);
+            if(table->count[slot] == 0) {
+                if(table->numColors == 256) {
+                    return 0;
+                }
+                table->color[slot] = color;
+                table->numColors++;
+            }
+            table->count[slot]++;
+        }
+    }
+
+    return status == 0;
+}
+
+/**
+ * Builds the palette with the most used colors first
+ *
+ * @param table counted colors, receives each color's index
+ * @param palette 256*3 bytes to fill
+ * @param transparent the index reserved for transparency, or -1
+ * @return the size of the palette, a power of 2
+ */
+static unsigned short buildPalette(ColorTable *table, unsigned char *palette, const int transparent) {
+    //insertion sort by count, there are at most 256 colors
+    size_t slots[256];
+    size_t numSlots = 0;
+    size_t i;
+    for(i = 0; i < COLOR_SLOTS; i++) {
+        if(table->count[i] != 0) {
+            size_t j = numSlots++;
+            for(; j > 0 && table->count[slots[j - 1]] < table->count[i]; j--) {
+                slots[j] = slots[j - 1];
+            }
+            slots[j] = i;
+        }
+    }
+
+    memset(palette, 0, 256*3);
+    size_t index = transparent >= 0 ? transparent + 1 : 0;
+    for(i = 0; i < numSlots; i++, index++) {
+        table->index[slots[i]] = index;
+        memcpy(palette + 3*index, table->color + slots[i], 3);
+    }
+
+    unsigned short numColors = 2;
+    while(numColors < index) {
+        numColors *= 2;
+    }
+    return numColors;
+}
+
+/**
+ * Encodes the part of a frame that differs from what the decoder shows
+ *
+ * Pixels that are opaque in this frame but transparent in the next one can
+ * only be cleared by this frame's disposal, so the rectangle grows to cover
+ * them and the frame is disposed to the background.
+ *
+ * @param gif gif to add the frame to
+ * @param table colors and their indices
+ * @param transparent the transparent index, or -1 if there is none
+ * @param base what the decoder shows before this frame, updated to what it
+ * shows after this frame is disposed
+ * @param frame the frame to show
+ * @param next the frame after it, or NULL for the last frame
+ * @param indices width*height buffer for the color indices
+ * @param width width of the canvas
+ * @param height height of the canvas
+ * @param delay delay of the frame
+ */
+static void addFrame(Gif *gif, const ColorTable *table, const int transparent,
+                     unsigned char *base, const unsigned char *frame,
+                     const unsigned char *next, unsigned char *indices,
+                     const size_t width, const size_t height, const unsigned short delay) {
+    size_t left = width, top = height, right = 0, bottom = 0;
+    GIF_Disposal disposal = GIF_DISPOSE_KEEP;
+
+    size_t x, y;
+    for(y = 0; y < height; y++) {
+        for(x = 0; x < width; x++) {
+            const size_t i = x + y*width;
+            int grow = pixelAt(frame, i) != pixelAt(base, i);
+            if(next != NULL && isTransparent(next, i) && !isTransparent(frame, i)) {
+                disposal = GIF_DISPOSE_BACKGROUND;
+                grow = 1;
+            }
+
+            if(grow) {
+                left = x < left ? x : left;
+                right = x + 1 > right ? x + 1 : right;
+                top = y < top ? y : top;
+                bottom = y + 1;
+            }
+        }
+    }
+
+    if(right == 0) { //nothing changed, the gif still needs an image
+        left = top = 0;
+        right = bottom = 1;
+    }
+
+    uint32_t lastColor = 0;
+    unsigned char lastIndex = 0;
+    int haveLast = 0;
+    for(y = top; y < bottom; y++) {
+        for(x = left; x < right; x++) {
+            const size_t i = x + y*width;
+            const uint32_t color = pixelAt(frame, i);
+            if(transparent >= 0 && color == pixelAt(base, i)) {
+                indices[i] = transparent;
+            }else{
+                if(!haveLast || color != lastColor) {
+                    lastColor = color;
+                    lastIndex = table->index[colorSlot(table, color)];
+                    haveLast = 1;
+                }
+                indices[i] = lastIndex;
+            }
+        }
+    }
+
+    GIF_SetFrameControl(gif, disposal, transparent);
+    GIF_AddImageStrided(gif, indices, width, left, top, right - left, bottom - top, delay);
+
+    memcpy(base, frame, 4 * width * height);
+    if(disposal == GIF_DISPOSE_BACKGROUND) {
+        for(y = top; y < bottom; y++) {
+            memset(base + 4*(left + y*width), 0, 4*(right - left));
+        }
+    }
+}
+
+/**
+ * Encodes the frames of a gif again
+ *
+ * @return the error, or NULL on success
+ */
+static const char *optimize(FrameReader *reader, const char *outName) {
+    ColorTable *table = malloc(sizeof(ColorTable));
+    if(!countColors(reader, table)) {
+        free(table);
+        return "too many colors or corrupt data";
+    }
+
+    //index 0 is left for the unchanged pixels if the palette has room
+    const int transparent = table->numColors < 256 ? 0 : -1;
+    if(table->hasTransparent && transparent < 0) {
+        free(table);
+        return "no room for a transparent color";
+    }
+
+    unsigned char palette[256*3];
+    unsigned short numColors = buildPalette(table, palette, transparent);
+
+    FILE *file = fopen(outName, "wb");
+    if(file == NULL) {
+        free(table);
+        return "could not write the file";
+    }
+
+    const size_t width = GIF_DecoderWidth(reader->dec);
+    const size_t height = GIF_DecoderHeight(reader->dec);
+    Gif *gif = GIF_Init(width, height, palette, numColors, 0);
+    GIF_SetRepeat(gif, GIF_DecoderRepeat(reader->dec));
+    GIF_SetClearStrategy(gif, GIF_CLEAR_BEST);
+    GIF_SetSink(gif, fileWrite, file);
+
+    unsigned char *base = calloc(reader->size, 1);
+    unsigned char *indices = malloc(width * height);
+
+    readerRewind(reader);
+    unsigned int delay;
+    while(readerNext(reader, &delay) == 1) {
+        addFrame(gif, table, transparent, base, reader->frame,
+                 reader->nextStatus == 1 ? reader->next : NULL,
+                 indices, width, height, delay);
+    }
+
+    int ok = GIF_Finish(gif);
+    GIF_Free(gif);
+    ok = fclose(file) == 0 && ok;
+    free(indices);
+    free(base);
+    free(table);
+
+    return ok ? NULL : "could not write the file";
+}
+
+/**
+ * Checks that two gifs show the same frames for the same times and loop the
+ * same number of times
+ */
+static int sameAnimation(const unsigned char *a, const size_t aSize,
+                         const unsigned char *b, const size_t bSize) {
+    FrameReader readerA, readerB;
+    if(!readerInit(&readerA, a, aSize)) {
+        return 0;
+    }
+    if(!readerInit(&readerB, b, bSize)) {
+        readerFree(&readerA);
+        return 0;
+    }
+
+    int same = readerA.size == readerB.size &&
+            GIF_DecoderWidth(readerA.dec) == GIF_DecoderWidth(readerB.dec) &&
+            GIF_DecoderRepeat(readerA.dec) == GIF_DecoderRepeat(readerB.dec);
+    while(same) {
+        unsigned int delayA, delayB;
+        int statusA = readerNext(&readerA, &delayA);
+        int statusB = readerNext(&readerB, &delayB);
+
+        if(statusA != statusB || statusA < 0) {
+            same = 0;
+        }else if(statusA == 0) {
+            break;
+        }else{
+            same = delayA == delayB && memcmp(readerA.frame, readerB.frame, readerA.size) == 0;
+        }
+    }
+
+    readerFree(&readerA);
+    readerFree(&readerB);
+    return same;
+}
+
+static void optimizeJob(Job *job) {
+    double start = now();
+
+    unsigned char *data = readFile(job->inName, &job->inSize);
+    if(data == NULL) {
+        job->error = "could not read the file";
+        return;
+    }
+
+    FrameReader reader;
+    if(!readerInit(&reader, data, job->inSize)) {
+        job->error = "not a gif";
+        free(data);
+        return;
+    }
+
+    job->error = optimize(&reader, job->outName);
+    readerFree(&reader);
+
+    //keep the original if it is smaller or the new file does not match it
+    unsigned char *out = NULL;
+    if(job->error == NULL) {
+        out = readFile(job->outName, &job->outSize);
+    }
+    if(out == NULL || job->outSize >= job->inSize ||
+            !sameAnimation(data, job->inSize, out, job->outSize)) {
+        job->kept = 1;
+        job->outSize = job->inSize;
+        if(!writeFile(job->outName, data, job->inSize)) {
+            job->error = "could not write the file";
+            job->kept = 0;
+        }
+    }
+
+    free(out);
+    free(data);
+    job->seconds = now() - start;
+}
+
+/**
+ * Optimizes files of the batch until there are none left
+ */
+static void *worker(void *arg) {
+    Batch *batch = arg;
+    while(1) {
+        pthread_mutex_lock(&batch->lock);
+        const size_t i = batch->nextJob++;
+        pthread_mutex_unlock(&batch->lock);
+
+        if(i >= batch->numJobs) {
+            break;
+        }
+        //jobs that already have an error are not started
+        if(batch->jobs[i].error == NULL) {
+            optimizeJob(batch->jobs + i);
+        }
+    }
+
+    return NULL;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-j threads] [-o suffix] file.gif...\n", name);
+    fprintf(stderr, "  -j  number of files to optimize at once (default: one per CPU)\n");
+    fprintf(stderr, "  -o  replaces .gif in the output names (default: %s), files it would\n"
+                    "      give the input's name are skipped\n", DEFAULT_SUFFIX);
+}
+
+int main(int argc, char *argv[]) {
+    long numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *suffix = DEFAULT_SUFFIX;
+
+    int opt;
+    while((opt = getopt(argc, argv, "j:o:")) != -1) {
+        if(opt == 'j') {
+            numThreads = atol(optarg);
+        }else if(opt == 'o') {
+            suffix = optarg;
+        }else{
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if(optind == argc || numThreads < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const size_t numJobs = argc - optind;
+    Job *jobs = calloc(numJobs, sizeof(Job));
+    size_t i;
+    for(i = 0; i < numJobs; i++) {
+        const char *name = argv[optind + i];
+        size_t length = strlen(name);
+        if(length >= 4 && strcmp(name + length - 4, ".gif") == 0) {
+            length -= 4;
+        }
+
+        jobs[i].inName = name;
+        jobs[i].outName = malloc(length + strlen(suffix) + 1);
+        memcpy(jobs[i].outName, name, length);
+        strcpy(jobs[i].outName + length, suffix);
+        if(sameFile(jobs[i].inName, jobs[i].outName)) {
+            jobs[i].error = "the output would overwrite the input";
+        }
+    }
+
+    double start = now();
+    Batch batch;
+    batch.jobs = jobs;
+    batch.numJobs = numJobs;
+    batch.nextJob = 0;
+    pthread_mutex_init(&batch.lock, NULL);
+    //the main thread is one of the workers, any that fail to start are skipped
+    pthread_t *threads = malloc(sizeof(pthread_t) * numThreads);
+    long numStarted = 0;
+    while(numStarted < numThreads - 1 && (size_t) numStarted + 1 < numJobs &&
+            pthread_create(threads + numStarted, NULL, worker, &batch) == 0) {
+        numStarted++;
+    }
+    worker(&batch);
+    while(numStarted > 0) {
+        pthread_join(threads[--numStarted], NULL);
+    }
+    free(threads);
+    pthread_mutex_destroy(&batch.lock);
+
+    size_t totalIn = 0, totalOut = 0;
+    int failed = 0;
+    for(i = 0; i < numJobs; i++) {
+        const Job *job = jobs + i;
+        if(job->error != NULL && !job->kept) {
+            printf("%s: %s\n", job->inName, job->error);
+            failed = 1;
+            continue;
+        }
+
+        totalIn += job->inSize;
+        totalOut += job->outSize;
+        printf("%s -> %s: %zu -> %zu bytes, saved %zu (%.1f%%) in %.1f ms",
+               job->inName, job->outName, job->inSize, job->outSize,
+               job->inSize - job->outSize,
+               job->inSize > 0 ? 100.0 * (job->inSize - job->outSize) / job->inSize : 0.0,
+               1000.0 * job->seconds);
+        if(job->kept) {
+            printf(", kept the original (%s)", job->error != NULL ? job->error : "no smaller");
+        }
+        printf("\n");
+    }
+
+    printf("Total: %zu -> %zu bytes, saved %zu in %.1f ms\n",
+           totalIn, totalOut, totalIn - totalOut, 1000.0 * (now() - start));
+
+    for(i = 0; i < numJobs; i++) {
+        free(jobs[i].outName);
+    }
+    free(jobs);
+
+    return failed;
+}